@@ -0,0 +1,521 @@
+/*
+ * Bit sliced AES using NEON instructions
+ *
+ * Eight blocks are processed at a time. The 128 bytes are transposed into
+ * eight 128-bit vectors so that vector k holds bit k of every byte: byte j
+ * of the vector is byte j of the AES state and bit b within it belongs to
+ * block b. SubBytes then becomes a boolean circuit evaluated on whole
+ * vectors, and ShiftRows and MixColumns become byte permutations of each
+ * vector. Nothing depends on the data, so the code runs in constant time.
+ *
+ * The code is written with GCC vector extensions, which this file is built
+ * to map onto NEON registers. The caller must bracket all calls with
+ * kernel_neon_begin() and kernel_neon_end().
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/string.h>
+
+#include "aesbs.h"
+
+#if __GNUC__ < 4 || (__GNUC__ == 4 && __GNUC_MINOR__ < 7)
+#error "The bit sliced AES code needs __builtin_shuffle() from GCC 4.7 or later"
+#endif
+
+typedef u8 bs_t __attribute__((vector_size(16)));
+
+#define BS_DUP(c)	{ c, c, c, c, c, c, c, c, c, c, c, c, c, c, c, c }
+
+static const bs_t shift_rows_idx = {
+	0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11
+};
+static const bs_t inv_shift_rows_idx = {
+	0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3
+};
+/* rotate the bytes of each column by one and two rows */
+static const bs_t rot1_idx = {
+	1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12
+};
+static const bs_t rot2_idx = {
+	2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13
+};
+
+static inline bs_t bs_load(const u8 *p)
+{
+	bs_t v;
+
+	__builtin_memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline void bs_store(u8 *p, bs_t v)
+{
+	__builtin_memcpy(p, &v, sizeof(v));
+}
+
+#define SWAPMOVE(a, b, n, m) do {			\
+	bs_t __t = (((a) >> (n)) ^ (b)) & (m);		\
+	(b) ^= __t;					\
+	(a) ^= __t << (n);				\
+} while (0)
+
+/*
+ * Transpose the 8x8 bit matrices formed by byte j of each of the eight
+ * vectors. Applied to eight blocks it yields the bit sliced state, applied
+ * to the bit sliced state it yields the blocks again.
+ */
+static inline void bs_transpose(bs_t q[8])
+{
+	const bs_t m1 = BS_DUP(0x55), m2 = BS_DUP(0x33), m4 = BS_DUP(0x0f);
+
+	SWAPMOVE(q[0], q[1], 1, m1);
+	SWAPMOVE(q[2], q[3], 1, m1);
+	SWAPMOVE(q[4], q[5], 1, m1);
+	SWAPMOVE(q[6], q[7], 1, m1);
+
+	SWAPMOVE(q[0], q[2], 2, m2);
+	SWAPMOVE(q[1], q[3], 2, m2);
+	SWAPMOVE(q[4], q[6], 2, m2);
+	SWAPMOVE(q[5], q[7], 2, m2);
+
+	SWAPMOVE(q[0], q[4], 4, m4);
+	SWAPMOVE(q[1], q[5], 4, m4);
+	SWAPMOVE(q[2], q[6], 4, m4);
+	SWAPMOVE(q[3], q[7], 4, m4);
+}
+
+/*
+ * The AES S-box as the 113 gate circuit of Boyar and Peralta. q[0] holds
+ * the least significant bit.
+ */
+static inline void bs_sub_bytes(bs_t q[8])
+{
+	bs_t x0, x1, x2, x3, x4, x5, x6, x7;
+	bs_t y1, y2, y3, y4, y5, y6, y7, y8, y9;
+	bs_t y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+	bs_t y20, y21;
+	bs_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+	bs_t z10, z11, z12, z13, z14, z15, z16, z17;
+	bs_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+	bs_t t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+	bs_t t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+	bs_t t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+	bs_t t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+	bs_t t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+	bs_t t60, t61, t62, t63, t64, t65, t66, t67;
+	bs_t s0, s1, s2, s3, s4, s5, s6, s7;
+
+	x0 = q[7];
+	x1 = q[6];
+	x2 = q[5];
+	x3 = q[4];
+	x4 = q[3];
+	x5 = q[2];
+	x6 = q[1];
+	x7 = q[0];
+
+	/* top linear transformation */
+	y14 = x3 ^ x5;
+	y13 = x0 ^ x6;
+	y9 = x0 ^ x3;
+	y8 = x0 ^ x5;
+	t0 = x1 ^ x2;
+	y1 = t0 ^ x7;
+	y4 = y1 ^ x3;
+	y12 = y13 ^ y14;
+	y2 = y1 ^ x0;
+	y5 = y1 ^ x6;
+	y3 = y5 ^ y8;
+	t1 = x4 ^ y12;
+	y15 = t1 ^ x5;
+	y20 = t1 ^ x1;
+	y6 = y15 ^ x7;
+	y10 = y15 ^ t0;
+	y11 = y20 ^ y9;
+	y7 = x7 ^ y11;
+	y17 = y10 ^ y11;
+	y19 = y10 ^ y8;
+	y16 = t0 ^ y11;
+	y21 = y13 ^ y16;
+	y18 = x0 ^ y16;
+
+	/* non-linear section */
+	t2 = y12 & y15;
+	t3 = y3 & y6;
+	t4 = t3 ^ t2;
+	t5 = y4 & x7;
+	t6 = t5 ^ t2;
+	t7 = y13 & y16;
+	t8 = y5 & y1;
+	t9 = t8 ^ t7;
+	t10 = y2 & y7;
+	t11 = t10 ^ t7;
+	t12 = y9 & y11;
+	t13 = y14 & y17;
+	t14 = t13 ^ t12;
+	t15 = y8 & y10;
+	t16 = t15 ^ t12;
+	t17 = t4 ^ t14;
+	t18 = t6 ^ t16;
+	t19 = t9 ^ t14;
+	t20 = t11 ^ t16;
+	t21 = t17 ^ y20;
+	t22 = t18 ^ y19;
+	t23 = t19 ^ y21;
+	t24 = t20 ^ y18;
+
+	t25 = t21 ^ t22;
+	t26 = t21 & t23;
+	t27 = t24 ^ t26;
+	t28 = t25 & t27;
+	t29 = t28 ^ t22;
+	t30 = t23 ^ t24;
+	t31 = t22 ^ t26;
+	t32 = t31 & t30;
+	t33 = t32 ^ t24;
+	t34 = t23 ^ t33;
+	t35 = t27 ^ t33;
+	t36 = t24 & t35;
+	t37 = t36 ^ t34;
+	t38 = t27 ^ t36;
+	t39 = t29 & t38;
+	t40 = t25 ^ t39;
+
+	t41 = t40 ^ t37;
+	t42 = t29 ^ t33;
+	t43 = t29 ^ t40;
+	t44 = t33 ^ t37;
+	t45 = t42 ^ t41;
+	z0 = t44 & y15;
+	z1 = t37 & y6;
+	z2 = t33 & x7;
+	z3 = t43 & y16;
+	z4 = t40 & y1;
+	z5 = t29 & y7;
+	z6 = t42 & y11;
+	z7 = t45 & y17;
+	z8 = t41 & y10;
+	z9 = t44 & y12;
+	z10 = t37 & y3;
+	z11 = t33 & y4;
+	z12 = t43 & y13;
+	z13 = t40 & y5;
+	z14 = t29 & y2;
+	z15 = t42 & y9;
+	z16 = t45 & y14;
+	z17 = t41 & y8;
+
+	/* bottom linear transformation */
+	t46 = z15 ^ z16;
+	t47 = z10 ^ z11;
+	t48 = z5 ^ z13;
+	t49 = z9 ^ z10;
+	t50 = z2 ^ z12;
+	t51 = z2 ^ z5;
+	t52 = z7 ^ z8;
+	t53 = z0 ^ z3;
+	t54 = z6 ^ z7;
+	t55 = z16 ^ z17;
+	t56 = z12 ^ t48;
+	t57 = t50 ^ t53;
+	t58 = z4 ^ t46;
+	t59 = z3 ^ t54;
+	t60 = t46 ^ t57;
+	t61 = z14 ^ t57;
+	t62 = t52 ^ t58;
+	t63 = t49 ^ t58;
+	t64 = z4 ^ t59;
+	t65 = t61 ^ t62;
+	t66 = z1 ^ t63;
+	s0 = t59 ^ t63;
+	s6 = t56 ^ ~t62;
+	s7 = t48 ^ ~t60;
+	t67 = t64 ^ t65;
+	s3 = t53 ^ t66;
+	s4 = t51 ^ t66;
+	s5 = t47 ^ t65;
+	s1 = t64 ^ ~s3;
+	s2 = t55 ^ ~t67;
+
+	q[7] = s0;
+	q[6] = s1;
+	q[5] = s2;
+	q[4] = s3;
+	q[3] = s4;
+	q[2] = s5;
+	q[1] = s6;
+	q[0] = s7;
+}
+
+/*
+ * The inverse of the affine transformation of the S-box, including its
+ * constant: y = rotl(x, 1) ^ rotl(x, 3) ^ rotl(x, 6) ^ 0x05.
+ */
+static inline void bs_inv_affine(bs_t q[8])
+{
+	bs_t x[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		x[i] = q[i];
+	for (i = 0; i < 8; i++)
+		q[i] = x[(i + 7) & 7] ^ x[(i + 5) & 7] ^ x[(i + 2) & 7];
+	q[0] = ~q[0];
+	q[2] = ~q[2];
+}
+
+/*
+ * InvSubBytes(x) = InvAffine(SubBytes(InvAffine(x))), as SubBytes is the
+ * affine transformation applied to the inverse in GF(2^8).
+ */
+static inline void bs_inv_sub_bytes(bs_t q[8])
+{
+	bs_inv_affine(q);
+	bs_sub_bytes(q);
+	bs_inv_affine(q);
+}
+
+static inline void bs_shift_rows(bs_t q[8], const bs_t idx)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		q[i] = __builtin_shuffle(q[i], idx);
+}
+
+/* multiply by x in GF(2^8), one bit plane per vector */
+static inline void bs_xtime(bs_t q[8])
+{
+	bs_t hi = q[7];
+
+	q[7] = q[6];
+	q[6] = q[5];
+	q[5] = q[4];
+	q[4] = q[3] ^ hi;
+	q[3] = q[2] ^ hi;
+	q[2] = q[1];
+	q[1] = q[0] ^ hi;
+	q[0] = hi;
+}
+
+/*
+ * b[r] = 2 * a[r] ^ 3 * a[r + 1] ^ a[r + 2] ^ a[r + 3]
+ *      = 2 * (a[r] ^ a[r + 1]) ^ a[r + 1] ^ (a[r + 2] ^ a[r + 3])
+ */
+static inline void bs_mix_columns(bs_t q[8])
+{
+	bs_t a1[8], t[8];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		a1[i] = __builtin_shuffle(q[i], rot1_idx);
+		t[i] = q[i] ^ a1[i];
+	}
+	for (i = 0; i < 8; i++)
+		q[i] = a1[i] ^ __builtin_shuffle(t[i], rot2_idx);
+	bs_xtime(t);
+	for (i = 0; i < 8; i++)
+		q[i] ^= t[i];
+}
+
+/*
+ * The InvMixColumns polynomial is the MixColumns one multiplied by
+ * 4x^2 + 5, so premultiply: a[r] ^= 4 * (a[r] ^ a[r + 2]).
+ */
+static inline void bs_inv_mix_columns(bs_t q[8])
+{
+	bs_t u[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		u[i] = q[i] ^ __builtin_shuffle(q[i], rot2_idx);
+	bs_xtime(u);
+	bs_xtime(u);
+	for (i = 0; i < 8; i++)
+		q[i] ^= u[i];
+	bs_mix_columns(q);
+}
+
+static inline void bs_add_round_key(bs_t q[8], const u8 rk[8][16])
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		q[i] ^= *(const bs_t *)rk[i];
+}
+
+static void bs_encrypt(const struct aesbs_key *key, bs_t q[8])
+{
+	int r;
+
+	bs_add_round_key(q, key->rk[0]);
+	for (r = 1; r < key->rounds; r++) {
+		bs_sub_bytes(q);
+		bs_shift_rows(q, shift_rows_idx);
+		bs_mix_columns(q);
+		bs_add_round_key(q, key->rk[r]);
+	}
+	bs_sub_bytes(q);
+	bs_shift_rows(q, shift_rows_idx);
+	bs_add_round_key(q, key->rk[key->rounds]);
+}
+
+static void bs_decrypt(const struct aesbs_key *key, bs_t q[8])
+{
+	int r;
+
+	bs_add_round_key(q, key->rk[key->rounds]);
+	for (r = key->rounds - 1; r > 0; r--) {
+		bs_shift_rows(q, inv_shift_rows_idx);
+		bs_inv_sub_bytes(q);
+		bs_add_round_key(q, key->rk[r]);
+		bs_inv_mix_columns(q);
+	}
+	bs_shift_rows(q, inv_shift_rows_idx);
+	bs_inv_sub_bytes(q);
+	bs_add_round_key(q, key->rk[0]);
+}
+
+/*
+ * Run up to eight blocks from "in" through the cipher into "out". Unused
+ * lanes are processed as zero blocks and discarded.
+ */
+static void bs_crypt_blocks(const struct aesbs_key *key, u8 *out,
+			    const u8 *in, unsigned int blocks, bool enc)
+{
+	bs_t q[AESBS_BLOCKS];
+	unsigned int i;
+
+	for (i = 0; i < AESBS_BLOCKS; i++)
+		q[i] = i < blocks ? bs_load(in + 16 * i) : (bs_t)BS_DUP(0);
+
+	bs_transpose(q);
+	if (enc)
+		bs_encrypt(key, q);
+	else
+		bs_decrypt(key, q);
+	bs_transpose(q);
+
+	for (i = 0; i < blocks; i++)
+		bs_store(out + 16 * i, q[i]);
+}
+
+static inline void bs_xor_block(u8 *dst, const u8 *a, const u8 *b)
+{
+	bs_store(dst, bs_load(a) ^ bs_load(b));
+}
+
+void aesbs_cbc_decrypt(const struct aesbs_key *key, u8 *dst, const u8 *src,
+		       unsigned int blocks, u8 *iv)
+{
+	u8 in[AESBS_BLOCKS * 16] __aligned(16);
+	u8 buf[AESBS_BLOCKS * 16] __aligned(16);
+	unsigned int i, n;
+
+	while (blocks) {
+		n = min_t(unsigned int, blocks, AESBS_BLOCKS);
+
+		/* keep the ciphertext, dst may overwrite it */
+		memcpy(in, src, n * 16);
+		bs_crypt_blocks(key, buf, in, n, false);
+
+		bs_xor_block(dst, buf, iv);
+		for (i = 1; i < n; i++)
+			bs_xor_block(dst + 16 * i, buf + 16 * i,
+				     in + 16 * (i - 1));
+		memcpy(iv, in + 16 * (n - 1), 16);
+
+		src += n * 16;
+		dst += n * 16;
+		blocks -= n;
+	}
+}
+
+/* increment a 128-bit big endian counter */
+static inline void aesbs_ctr_inc(u8 *ctr)
+{
+	int i;
+
+	for (i = 15; i >= 0; i--)
+		if (++ctr[i])
+			break;
+}
+
+void aesbs_ctr_encrypt(const struct aesbs_key *key, u8 *dst, const u8 *src,
+		       unsigned int blocks, u8 *ctr)
+{
+	u8 buf[AESBS_BLOCKS * 16] __aligned(16);
+	unsigned int i, n;
+
+	while (blocks) {
+		n = min_t(unsigned int, blocks, AESBS_BLOCKS);
+
+		for (i = 0; i < n; i++) {
+			memcpy(buf + 16 * i, ctr, 16);
+			aesbs_ctr_inc(ctr);
+		}
+		bs_crypt_blocks(key, buf, buf, n, true);
+
+		for (i = 0; i < n; i++)
+			bs_xor_block(dst + 16 * i, src + 16 * i, buf + 16 * i);
+
+		src += n * 16;
+		dst += n * 16;
+		blocks -= n;
+	}
+}
+
+/* multiply the tweak by x in GF(2^128), little endian convention */
+static inline void aesbs_xts_next(u8 *t)
+{
+	u8 carry = t[15] >> 7;
+	int i;
+
+	for (i = 15; i > 0; i--)
+		t[i] = (t[i] << 1) | (t[i - 1] >> 7);
+	t[0] = (t[0] << 1) ^ (carry ? 0x87 : 0);
+}
+
+static void aesbs_xts_crypt(const struct aesbs_key *key, u8 *dst,
+			    const u8 *src, unsigned int blocks, u8 *tweak,
+			    bool enc)
+{
+	u8 t[AESBS_BLOCKS * 16] __aligned(16);
+	u8 buf[AESBS_BLOCKS * 16] __aligned(16);
+	unsigned int i, n;
+
+	while (blocks) {
+		n = min_t(unsigned int, blocks, AESBS_BLOCKS);
+
+		for (i = 0; i < n; i++) {
+			memcpy(t + 16 * i, tweak, 16);
+			aesbs_xts_next(tweak);
+			bs_xor_block(buf + 16 * i, src + 16 * i, t + 16 * i);
+		}
+		bs_crypt_blocks(key, buf, buf, n, enc);
+
+		for (i = 0; i < n; i++)
+			bs_xor_block(dst + 16 * i, buf + 16 * i, t + 16 * i);
+
+		src += n * 16;
+		dst += n * 16;
+		blocks -= n;
+	}
+}
+
+void aesbs_xts_encrypt(const struct aesbs_key *key, u8 *dst, const u8 *src,
+		       unsigned int blocks, u8 *tweak)
+{
+	aesbs_xts_crypt(key, dst, src, blocks, tweak, true);
+}
+
+void aesbs_xts_decrypt(const struct aesbs_key *key, u8 *dst, const u8 *src,
+		       unsigned int blocks, u8 *tweak)
+{
+	aesbs_xts_crypt(key, dst, src, blocks, tweak, false);
+}
@@ -0,0 +1,40 @@
+/*
+ * Bit sliced AES using NEON instructions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _ARM_CRYPTO_AESBS_H
+#define _ARM_CRYPTO_AESBS_H
+
+#include <linux/types.h>
+
+#define AESBS_MAX_ROUNDS	14
+#define AESBS_BLOCKS		8	/* blocks processed in parallel */
+
+/*
+ * Round keys in bit sliced form: byte j of rk[r][k] is 0xff if bit k of
+ * byte j of round key r is set and 0 otherwise.
+ */
+struct aesbs_key {
+	u8 rk[AESBS_MAX_ROUNDS + 1][8][16] __aligned(16);
+	int rounds;
+};
+
+/*
+ * The following routines use NEON registers and must only be called
+ * between kernel_neon_begin() and kernel_neon_end(). All lengths are in
+ * 16 byte blocks; dst and src may be the same buffer.
+ */
+void aesbs_cbc_decrypt(const struct aesbs_key *key, u8 *dst, const u8 *src,
+		       unsigned int blocks, u8 *iv);
+void aesbs_ctr_encrypt(const struct aesbs_key *key, u8 *dst, const u8 *src,
+		       unsigned int blocks, u8 *ctr);
+void aesbs_xts_encrypt(const struct aesbs_key *key, u8 *dst, const u8 *src,
+		       unsigned int blocks, u8 *tweak);
+void aesbs_xts_decrypt(const struct aesbs_key *key, u8 *dst, const u8 *src,
+		       unsigned int blocks, u8 *tweak);
+
+#endif
@@ -0,0 +1,37 @@
+/*
+ * linux/arch/arm/include/asm/neon.h
+ *
+ * Copyright (C) 2013 Linaro Ltd <ard.biesheuvel@linaro.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef __ASM_ARM_NEON_H
+#define __ASM_ARM_NEON_H
+
+#include <linux/bug.h>
+#include <asm/hwcap.h>
+
+#define cpu_has_neon()		(!!(elf_hwcap & HWCAP_NEON))
+
+#ifdef __ARM_NEON__
+
+/*
+ * If you are affected by the BUILD_BUG_ON below, it probably means that you are
+ * using NEON code /and/ calling the kernel_neon_begin() function from the
+ * same compilation unit. To prevent issues that may arise from GCC
+ * reordering or generating NEON instructions outside of these begin/end
+ * functions, the only supported way of using NEON code in the kernel is
+ * by isolating it in a separate compilation unit, and calling it from
+ * another unit from inside a kernel_neon_begin/kernel_neon_end pair.
+ */
+#define kernel_neon_begin()	BUILD_BUG_ON(1)
+
+#else
+void kernel_neon_begin(void);
+#endif
+void kernel_neon_end(void);
+
+#endif /* __ASM_ARM_NEON_H */
@@ -24,6 +24,12 @@
 #include <linux/vmalloc.h>
 #include <linux/lz4.h>
 
+/* Trade compression ratio for speed, see lz4_compress_fast() */
+static int acceleration = LZ4_ACCELERATION_DEFAULT;
+module_param(acceleration, int, 0644);
+MODULE_PARM_DESC(acceleration, "LZ4 acceleration factor "
+		 "(1 is regular LZ4, higher is faster with less compression)");
+
 struct lz4_ctx {
 	void *lz4_comp_mem;
 };
@@ -52,7 +58,8 @@ static int lz4_compress_crypto(struct crypto_tfm *tfm, const u8 *src,
 	size_t tmp_len = *dlen;
 	int err;
 
-	err = lz4_compress(src, slen, dst, &tmp_len, ctx->lz4_comp_mem);
+	err = lz4_compress_fast(src, slen, dst, &tmp_len, ctx->lz4_comp_mem,
+				ACCESS_ONCE(acceleration));
 
 	if (err < 0)
 		return -EINVAL;
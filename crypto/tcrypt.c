@@ -33,6 +33,10 @@
 #include <linux/jiffies.h>
 #include <linux/timex.h>
 #include <linux/interrupt.h>
+#include <linux/vmalloc.h>
+#include <linux/random.h>
+#include <linux/highmem.h>
+#include <linux/ktime.h>
 #include "tcrypt.h"
 #include "internal.h"
 
@@ -52,6 +56,11 @@
  */
 static unsigned int sec;
 
+/*
+ * Used by test_comp_speed()
+ */
+static unsigned int comp_blen;
+
 static char *alg = NULL;
 static u32 type;
 static u32 mask;
@@ -920,6 +929,253 @@ out:
 	crypto_free_ablkcipher(tfm);
 }
 
+static int do_one_comp_op(struct crypto_comp *tfm, int comp, const u8 *src,
+			  unsigned int slen, u8 *dst, unsigned int dmax)
+{
+	unsigned int dlen = dmax;
+
+	if (comp)
+		return crypto_comp_compress(tfm, src, slen, dst, &dlen);
+	else
+		return crypto_comp_decompress(tfm, src, slen, dst, &dlen);
+}
+
+/* Throughput in MB/s, always counted in uncompressed bytes */
+static unsigned long long comp_mbps(unsigned long ops, unsigned int blen,
+				    ktime_t start)
+{
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	if (ns <= 0)
+		return 0;
+
+	return div64_u64((u64)ops * blen * 1000, ns);
+}
+
+static int test_comp_jiffies(struct crypto_comp *tfm, int comp, const u8 *src,
+			     unsigned int slen, u8 *dst, unsigned int dmax,
+			     unsigned int blen, int sec)
+{
+	unsigned long start, end;
+	ktime_t kstart;
+	int bcount;
+	int ret;
+
+	kstart = ktime_get();
+	for (start = jiffies, end = start + sec * HZ, bcount = 0;
+	     time_before(jiffies, end); bcount++) {
+		ret = do_one_comp_op(tfm, comp, src, slen, dst, dmax);
+		if (ret)
+			return ret;
+	}
+
+	pr_cont("%8d operations in %d seconds, %5llu MB/s\n",
+		bcount, sec, comp_mbps(bcount, blen, kstart));
+	return 0;
+}
+
+static int test_comp_cycles(struct crypto_comp *tfm, int comp, const u8 *src,
+			    unsigned int slen, u8 *dst, unsigned int dmax,
+			    unsigned int blen)
+{
+	unsigned long cycles = 0;
+	ktime_t kstart;
+	int ret, i;
+
+	/* Warm-up run. */
+	for (i = 0; i < 4; i++) {
+		ret = do_one_comp_op(tfm, comp, src, slen, dst, dmax);
+		if (ret)
+			return ret;
+	}
+
+	/* The real thing. */
+	kstart = ktime_get();
+	for (i = 0; i < 8; i++) {
+		cycles_t start, end;
+
+		start = get_cycles();
+		ret = do_one_comp_op(tfm, comp, src, slen, dst, dmax);
+		end = get_cycles();
+
+		if (ret)
+			return ret;
+
+		cycles += end - start;
+	}
+
+	pr_cont("%8lu cycles/operation, %4lu cycles/byte, %5llu MB/s\n",
+		cycles / 8, cycles / (8 * blen), comp_mbps(8, blen, kstart));
+	return 0;
+}
+
+static void comp_fill_zero(u8 *buf, unsigned int len)
+{
+	memset(buf, 0, len);
+}
+
+static void comp_fill_text(u8 *buf, unsigned int len)
+{
+	static const char * const words[] = {
+		"the ", "of ", "and ", "a ", "to ", "in ", "is ", "kernel ",
+		"memory ", "page ", "block ", "device ", "data ", "file ",
+		"system ", "compression ", "cache ", "read ", "write ", ". ",
+		", ", "\n",
+	};
+	struct rnd_state rnd;
+	unsigned int i = 0;
+
+	prandom32_seed(&rnd, 1);
+	while (i < len) {
+		const char *w = words[prandom32(&rnd) % ARRAY_SIZE(words)];
+
+		while (*w && i < len)
+			buf[i++] = *w++;
+	}
+}
+
+static void comp_fill_random(u8 *buf, unsigned int len)
+{
+	get_random_bytes(buf, len);
+}
+
+/*
+ * Sample pages spread evenly over system memory, to get data resembling
+ * what zram and friends actually see.
+ */
+static void comp_fill_pages(u8 *buf, unsigned int len)
+{
+	unsigned long pfn, step, tries = 0;
+	unsigned int i;
+	void *addr;
+
+	step = max_t(unsigned long, num_physpages / (len / PAGE_SIZE + 1), 1);
+	pfn = ARCH_PFN_OFFSET + step / 2;
+
+	for (i = 0; i < len; i += PAGE_SIZE, pfn += step) {
+		struct page *page;
+
+		while (!pfn_valid(pfn) || PageReserved(pfn_to_page(pfn))) {
+			if (++tries > num_physpages) {
+				memset(buf + i, 0, len - i);
+				return;
+			}
+			if (++pfn >= ARCH_PFN_OFFSET + num_physpages)
+				pfn = ARCH_PFN_OFFSET;
+		}
+
+		page = pfn_to_page(pfn);
+		addr = kmap_atomic(page);
+		memcpy(buf + i, addr, min_t(unsigned int, len - i, PAGE_SIZE));
+		kunmap_atomic(addr);
+	}
+}
+
+static const struct {
+	const char *name;
+	void (*fill)(u8 *buf, unsigned int len);
+} comp_corpora[] = {
+	{ "zero", comp_fill_zero },
+	{ "text", comp_fill_text },
+	{ "random", comp_fill_random },
+	{ "pages", comp_fill_pages },
+};
+
+static void test_comp_speed(const char *algo, unsigned int sec, u32 *b_size)
+{
+	struct crypto_comp *tfm;
+	unsigned int i, j, clen, dlen, test = 0;
+	u32 single[] = { comp_blen, 0 };
+	u8 *src, *cmp, *dst;
+	int ret;
+
+	printk(KERN_INFO "\ntesting speed of %s compression\n", algo);
+
+	tfm = crypto_alloc_comp(algo, 0, 0);
+	if (IS_ERR(tfm)) {
+		pr_err("failed to load transform for %s: %ld\n", algo,
+		       PTR_ERR(tfm));
+		return;
+	}
+
+	if (comp_blen) {
+		if (comp_blen > COMP_SPEED_MAX_SIZE) {
+			pr_err("comp_blen (%u) too big, max %u\n", comp_blen,
+			       COMP_SPEED_MAX_SIZE);
+			goto out_tfm;
+		}
+		b_size = single;
+	}
+
+	/* Leave room for incompressible data to expand */
+	src = vmalloc(COMP_SPEED_MAX_SIZE);
+	cmp = vmalloc(COMP_SPEED_MAX_SIZE * 2);
+	dst = vmalloc(COMP_SPEED_MAX_SIZE);
+	if (!src || !cmp || !dst) {
+		pr_err("compression buffer allocation failure\n");
+		goto out;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(comp_corpora); i++) {
+		comp_corpora[i].fill(src, COMP_SPEED_MAX_SIZE);
+
+		for (j = 0; b_size[j]; j++, test++) {
+			unsigned int blen = b_size[j];
+
+			clen = COMP_SPEED_MAX_SIZE * 2;
+			ret = crypto_comp_compress(tfm, src, blen, cmp, &clen);
+			if (ret) {
+				pr_err("test%3u: compression failed ret=%d\n",
+				       test, ret);
+				continue;
+			}
+
+			dlen = COMP_SPEED_MAX_SIZE;
+			ret = crypto_comp_decompress(tfm, cmp, clen, dst, &dlen);
+			if (ret || dlen != blen || memcmp(src, dst, blen)) {
+				pr_err("test%3u: decompression failed ret=%d\n",
+				       test, ret);
+				continue;
+			}
+
+			pr_info("test%3u (%-6s %6u bytes -> %6u bytes, "
+				"ratio %u.%02u)\n", test, comp_corpora[i].name,
+				blen, clen, blen / clen,
+				(blen % clen) * 100 / clen);
+
+			pr_info("    compress:   ");
+			if (sec)
+				ret = test_comp_jiffies(tfm, 1, src, blen, cmp,
+						COMP_SPEED_MAX_SIZE * 2, blen,
+						sec);
+			else
+				ret = test_comp_cycles(tfm, 1, src, blen, cmp,
+						COMP_SPEED_MAX_SIZE * 2, blen);
+			if (ret) {
+				pr_err("compression failed ret=%d\n", ret);
+				continue;
+			}
+
+			pr_info("    decompress: ");
+			if (sec)
+				ret = test_comp_jiffies(tfm, 0, cmp, clen, dst,
+						COMP_SPEED_MAX_SIZE, blen, sec);
+			else
+				ret = test_comp_cycles(tfm, 0, cmp, clen, dst,
+						COMP_SPEED_MAX_SIZE, blen);
+			if (ret)
+				pr_err("decompression failed ret=%d\n", ret);
+		}
+	}
+
+out:
+	vfree(dst);
+	vfree(cmp);
+	vfree(src);
+out_tfm:
+	crypto_free_comp(tfm);
+}
+
 static void test_available(void)
 {
 	char **name = check;
@@ -1563,6 +1819,28 @@ static int do_test(int m)
 				   speed_template_32_64);
 		break;
 
+	case 600:
+		/* fall through */
+
+	case 601:
+		test_comp_speed("deflate", sec, comp_speed_template);
+		if (mode > 600 && mode < 700) break;
+
+	case 602:
+		test_comp_speed("lzo", sec, comp_speed_template);
+		if (mode > 600 && mode < 700) break;
+
+	case 603:
+		test_comp_speed("lz4", sec, comp_speed_template);
+		if (mode > 600 && mode < 700) break;
+
+	case 604:
+		test_comp_speed("lz4hc", sec, comp_speed_template);
+		if (mode > 600 && mode < 700) break;
+
+	case 699:
+		break;
+
 	case 1000:
 		test_available();
 		break;
@@ -1631,6 +1909,9 @@ module_param(mode, int, 0);
 module_param(sec, uint, 0);
 MODULE_PARM_DESC(sec, "Length in seconds of speed tests "
 		      "(defaults to zero which uses CPU cycles instead)");
+module_param(comp_blen, uint, 0);
+MODULE_PARM_DESC(comp_blen, "Buffer size of compression speed tests "
+		 "(defaults to zero which uses the built-in sizes)");
 
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Quick & dirty crypto testing module");
@@ -114,4 +114,11 @@ static struct hash_speed hash_speed_template_16[] = {
 	{  .blen = 0,	.plen = 0,	.klen = 0, }
 };
 
+/*
+ * Compression speed tests
+ */
+#define COMP_SPEED_MAX_SIZE	131072
+
+static u32 comp_speed_template[] = {512, 4096, 16384, 65536, 131072, 0};
+
 #endif	/* _CRYPTO_TCRYPT_H */
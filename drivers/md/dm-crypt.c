@@ -42,8 +42,10 @@ struct convert_context {
 	unsigned int idx_in;
 	unsigned int idx_out;
 	sector_t sector;
+	sector_t sector_end;	/* stop before this sector, if set */
 	atomic_t cc_pending;
 	struct ablkcipher_request *req;
+	bool no_sleep;		/* converting from a bio completion */
 };
 
 /*
@@ -62,6 +64,23 @@ struct dm_crypt_io {
 	struct dm_crypt_io *base_io;
 };
 
+/*
+ * State shared by the chunks of one parallel conversion, see
+ * crypt_convert_parallel().
+ */
+struct dm_crypt_parallel {
+	atomic_t pending;
+	int error;
+	struct completion done;
+};
+
+struct dm_crypt_chunk {
+	struct crypt_config *cc;
+	struct dm_crypt_parallel *par;
+	struct convert_context ctx;
+	struct work_struct work;
+};
+
 struct dm_crypt_request {
 	struct convert_context *ctx;
 	struct scatterlist sg_in;
@@ -102,7 +121,8 @@ struct iv_lmk_private {
  * Crypt: maps a linear range of a block device
  * and encrypts / decrypts at the same time.
  */
-enum flags { DM_CRYPT_SUSPENDED, DM_CRYPT_KEY_VALID };
+enum flags { DM_CRYPT_SUSPENDED, DM_CRYPT_KEY_VALID,
+	     DM_CRYPT_PARALLEL, DM_CRYPT_READ_BYPASS };
 
 /*
  * The fields in here must be read only after initialization,
@@ -118,10 +138,12 @@ struct crypt_config {
 	mempool_t *io_pool;
 	mempool_t *req_pool;
 	mempool_t *page_pool;
+	mempool_t *chunk_pool;
 	struct bio_set *bs;
 
 	struct workqueue_struct *io_queue;
 	struct workqueue_struct *crypt_queue;
+	struct workqueue_struct *chunk_queue;
 
 	char *cipher;
 	char *cipher_string;
@@ -164,10 +186,16 @@ struct crypt_config {
 #define MIN_IOS        16
 #define MIN_POOL_PAGES 32
 
+/*
+ * Smallest number of sectors handed to another CPU by "parallel_crypt".
+ */
+#define MIN_CHUNK_SECTORS 32
+
 static struct kmem_cache *_crypt_io_pool;
 
 static void clone_init(struct dm_crypt_io *, struct bio *);
 static void kcryptd_queue_crypt(struct dm_crypt_io *io);
+static bool kcryptd_crypt_read_bypass(struct dm_crypt_io *io);
 static u8 *iv_of_dmreq(struct crypt_config *cc, struct dm_crypt_request *dmreq);
 
 /*
@@ -178,6 +206,16 @@ static struct crypto_ablkcipher *any_tfm(struct crypt_config *cc)
 	return cc->tfms[0];
 }
 
+/*
+ * Synchronous ciphers complete every request before returning, so the
+ * conversion may be split or run from a bio completion.
+ */
+static bool crypt_tfm_is_sync(struct crypt_config *cc)
+{
+	return !(crypto_ablkcipher_tfm(any_tfm(cc))->__crt_alg->cra_flags &
+		 CRYPTO_ALG_ASYNC);
+}
+
 /*
  * Different IV generation algorithms:
  *
@@ -638,6 +676,7 @@ static void crypt_convert_init(struct crypt_config *cc,
 	ctx->idx_in = bio_in ? bio_in->bi_idx : 0;
 	ctx->idx_out = bio_out ? bio_out->bi_idx : 0;
 	ctx->sector = sector + cc->iv_offset;
+	ctx->sector_end = 0;
 	init_completion(&ctx->restart);
 }
 
@@ -728,6 +767,7 @@ static void crypt_alloc_req(struct crypt_config *cc,
 
 	ablkcipher_request_set_tfm(ctx->req, cc->tfms[key_index]);
 	ablkcipher_request_set_callback(ctx->req,
+	    ctx->no_sleep ? 0 :
 	    CRYPTO_TFM_REQ_MAY_BACKLOG | CRYPTO_TFM_REQ_MAY_SLEEP,
 	    kcryptd_async_done, dmreq_of_req(cc, ctx->req));
 }
@@ -743,7 +783,8 @@ static int crypt_convert(struct crypt_config *cc,
 	atomic_set(&ctx->cc_pending, 1);
 
 	while(ctx->idx_in < ctx->bio_in->bi_vcnt &&
-	      ctx->idx_out < ctx->bio_out->bi_vcnt) {
+	      ctx->idx_out < ctx->bio_out->bi_vcnt &&
+	      (!ctx->sector_end || ctx->sector < ctx->sector_end)) {
 
 		crypt_alloc_req(cc, ctx);
 
@@ -766,7 +807,8 @@ static int crypt_convert(struct crypt_config *cc,
 		case 0:
 			atomic_dec(&ctx->cc_pending);
 			ctx->sector++;
-			cond_resched();
+			if (!ctx->no_sleep)
+				cond_resched();
 			continue;
 
 		/* error */
@@ -779,6 +821,193 @@ static int crypt_convert(struct crypt_config *cc,
 	return 0;
 }
 
+/*
+ * Return the number of bytes of "bio" from vector "idx", offset "offset"
+ * to its end.
+ */
+static unsigned crypt_bytes_left(struct bio *bio, unsigned idx,
+				 unsigned offset)
+{
+	unsigned bytes = 0;
+
+	for (; idx < bio->bi_vcnt; idx++)
+		bytes += bio_iovec_idx(bio, idx)->bv_len;
+
+	return bytes - offset;
+}
+
+/*
+ * Move the position of a conversion forward by "sectors" sectors.
+ */
+static void crypt_convert_advance(struct convert_context *ctx,
+				  unsigned sectors)
+{
+	unsigned bytes;
+
+	ctx->sector += sectors;
+
+	for (bytes = sectors << SECTOR_SHIFT; bytes; ) {
+		struct bio_vec *bv = bio_iovec_idx(ctx->bio_in, ctx->idx_in);
+		unsigned len = min(bytes, bv->bv_len - ctx->offset_in);
+
+		ctx->offset_in += len;
+		if (ctx->offset_in >= bv->bv_len) {
+			ctx->offset_in = 0;
+			ctx->idx_in++;
+		}
+		bytes -= len;
+	}
+
+	for (bytes = sectors << SECTOR_SHIFT; bytes; ) {
+		struct bio_vec *bv = bio_iovec_idx(ctx->bio_out, ctx->idx_out);
+		unsigned len = min(bytes, bv->bv_len - ctx->offset_out);
+
+		ctx->offset_out += len;
+		if (ctx->offset_out >= bv->bv_len) {
+			ctx->offset_out = 0;
+			ctx->idx_out++;
+		}
+		bytes -= len;
+	}
+}
+
+/*
+ * Convert one chunk and report it to the parallel conversion. Queued
+ * chunks own their crypto request, the chunk converted by the caller
+ * borrows the caller's.
+ */
+static void crypt_convert_chunk(struct crypt_config *cc,
+				struct dm_crypt_parallel *par,
+				struct convert_context *ctx, bool own_req)
+{
+	int r;
+
+	r = crypt_convert(cc, ctx);
+	if (own_req)
+		mempool_free(ctx->req, cc->req_pool);
+
+	if (unlikely(r < 0))
+		cmpxchg(&par->error, 0, r);
+
+	if (atomic_dec_and_test(&par->pending))
+		complete(&par->done);
+}
+
+static void kcryptd_crypt_chunk(struct work_struct *work)
+{
+	struct dm_crypt_chunk *chunk = container_of(work, struct dm_crypt_chunk,
+						    work);
+	struct crypt_config *cc = chunk->cc;
+
+	crypt_convert_chunk(cc, chunk->par, &chunk->ctx, true);
+	mempool_free(chunk, cc->chunk_pool);
+}
+
+/*
+ * Split the conversion into chunks of at least MIN_CHUNK_SECTORS sectors,
+ * one per online CPU, and convert them concurrently on the unbound
+ * chunk_queue. Only used with synchronous ciphers, so each chunk is done
+ * when crypt_convert() returns for it.
+ *
+ * Chunks and their requests are allocated without waiting; a chunk that
+ * cannot be handed off is converted here with the caller's request. The
+ * function returns only after every chunk has finished, so bios are
+ * submitted and completed in the same order as without splitting.
+ */
+static int crypt_convert_parallel(struct crypt_config *cc,
+				  struct convert_context *ctx)
+{
+	struct dm_crypt_parallel par;
+	struct convert_context pos;
+	unsigned total, per_chunk;
+	int r;
+
+	total = min(crypt_bytes_left(ctx->bio_in, ctx->idx_in, ctx->offset_in),
+		    crypt_bytes_left(ctx->bio_out, ctx->idx_out,
+				     ctx->offset_out)) >> SECTOR_SHIFT;
+	if (total < 2 * MIN_CHUNK_SECTORS || num_online_cpus() < 2)
+		return crypt_convert(cc, ctx);
+
+	per_chunk = max_t(unsigned, MIN_CHUNK_SECTORS,
+			  DIV_ROUND_UP(total, num_online_cpus()));
+
+	crypt_alloc_req(cc, ctx);
+
+	atomic_set(&par.pending, 1);
+	par.error = 0;
+	init_completion(&par.done);
+
+	/* the first chunk stays in ctx and is converted last, here */
+	pos = *ctx;
+	crypt_convert_advance(&pos, per_chunk);
+
+	while (pos.sector - ctx->sector < total) {
+		unsigned sectors = min_t(unsigned, per_chunk,
+					 total - (pos.sector - ctx->sector));
+		struct dm_crypt_chunk *chunk;
+		struct convert_context local;
+
+		chunk = mempool_alloc(cc->chunk_pool, GFP_NOWAIT);
+		if (chunk) {
+			chunk->ctx = pos;
+			init_completion(&chunk->ctx.restart);
+			chunk->ctx.req = mempool_alloc(cc->req_pool, GFP_NOWAIT);
+			if (!chunk->ctx.req) {
+				mempool_free(chunk, cc->chunk_pool);
+				chunk = NULL;
+			}
+		}
+
+		atomic_inc(&par.pending);
+
+		if (chunk) {
+			chunk->cc = cc;
+			chunk->par = &par;
+			chunk->ctx.sector_end = pos.sector + sectors;
+			INIT_WORK(&chunk->work, kcryptd_crypt_chunk);
+			queue_work(cc->chunk_queue, &chunk->work);
+		} else {
+			local = pos;
+			init_completion(&local.restart);
+			local.req = ctx->req;
+			local.sector_end = pos.sector + sectors;
+			crypt_convert_chunk(cc, &par, &local, false);
+		}
+
+		crypt_convert_advance(&pos, sectors);
+	}
+
+	ctx->sector_end = ctx->sector + per_chunk;
+	r = crypt_convert(cc, ctx);
+
+	if (!atomic_dec_and_test(&par.pending))
+		wait_for_completion(&par.done);
+
+	/* leave ctx where a serial conversion would have left it */
+	ctx->idx_in = pos.idx_in;
+	ctx->offset_in = pos.offset_in;
+	ctx->idx_out = pos.idx_out;
+	ctx->offset_out = pos.offset_out;
+	ctx->sector = pos.sector;
+	ctx->sector_end = 0;
+
+	return r < 0 ? r : par.error;
+}
+
+/*
+ * Convert the data of one io, in parallel chunks if that is enabled and
+ * possible.
+ */
+static int crypt_convert_io(struct crypt_config *cc,
+			    struct convert_context *ctx)
+{
+	if (test_bit(DM_CRYPT_PARALLEL, &cc->flags) && !ctx->no_sleep &&
+	    crypt_tfm_is_sync(cc))
+		return crypt_convert_parallel(cc, ctx);
+
+	return crypt_convert(cc, ctx);
+}
+
 static void dm_crypt_bio_destructor(struct bio *bio)
 {
 	struct dm_crypt_io *io = bio->bi_private;
@@ -868,6 +1097,7 @@ static struct dm_crypt_io *crypt_io_alloc(struct dm_target *ti,
 	io->error = 0;
 	io->base_io = NULL;
 	io->ctx.req = NULL;
+	io->ctx.no_sleep = false;
 	atomic_set(&io->io_pending, 0);
 
 	return io;
@@ -941,7 +1171,8 @@ static void crypt_endio(struct bio *clone, int error)
 	bio_put(clone);
 
 	if (rw == READ && !error) {
-		kcryptd_queue_crypt(io);
+		if (!kcryptd_crypt_read_bypass(io))
+			kcryptd_queue_crypt(io);
 		return;
 	}
 
@@ -1077,7 +1308,7 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 
 		crypt_inc_pending(io);
 
-		r = crypt_convert(cc, &io->ctx);
+		r = crypt_convert_io(cc, &io->ctx);
 		if (r < 0)
 			io->error = -EIO;
 		crypt_finished = atomic_dec_and_test(&io->ctx.cc_pending);
@@ -1150,7 +1381,7 @@ static void kcryptd_crypt_read_convert(struct dm_crypt_io *io)
 	crypt_convert_init(cc, &io->ctx, io->base_bio, io->base_bio,
 			   io->sector);
 
-	r = crypt_convert(cc, &io->ctx);
+	r = crypt_convert_io(cc, &io->ctx);
 
 	if (r < 0)
 		io->error = -EIO;
@@ -1161,6 +1392,32 @@ static void kcryptd_crypt_read_convert(struct dm_crypt_io *io)
 	crypt_dec_pending(io);
 }
 
+/*
+ * With "read_bypass" and a synchronous cipher, decrypt a read right in its
+ * completion instead of queueing it to kcryptd. The conversion must not
+ * sleep there, so it is only done outside hard interrupts and when the
+ * crypto request can be allocated without waiting.
+ */
+static bool kcryptd_crypt_read_bypass(struct dm_crypt_io *io)
+{
+	struct crypt_config *cc = io->target->private;
+
+	if (!test_bit(DM_CRYPT_READ_BYPASS, &cc->flags) || in_irq() ||
+	    irqs_disabled() || !crypt_tfm_is_sync(cc))
+		return false;
+
+	if (!io->ctx.req) {
+		io->ctx.req = mempool_alloc(cc->req_pool, GFP_NOWAIT);
+		if (!io->ctx.req)
+			return false;
+	}
+
+	io->ctx.no_sleep = true;
+	kcryptd_crypt_read_convert(io);
+
+	return true;
+}
+
 static void kcryptd_async_done(struct crypto_async_request *async_req,
 			       int error)
 {
@@ -1350,6 +1607,8 @@ static void crypt_dtr(struct dm_target *ti)
 		destroy_workqueue(cc->io_queue);
 	if (cc->crypt_queue)
 		destroy_workqueue(cc->crypt_queue);
+	if (cc->chunk_queue)
+		destroy_workqueue(cc->chunk_queue);
 
 	crypt_free_tfms(cc);
 
@@ -1358,6 +1617,8 @@ static void crypt_dtr(struct dm_target *ti)
 
 	if (cc->page_pool)
 		mempool_destroy(cc->page_pool);
+	if (cc->chunk_pool)
+		mempool_destroy(cc->chunk_pool);
 	if (cc->req_pool)
 		mempool_destroy(cc->req_pool);
 	if (cc->io_pool)
@@ -1530,7 +1791,7 @@ bad_mem:
 
 /*
  * Construct an encryption mapping:
- * <cipher> <key> <iv_offset> <dev_path> <start>
+ * <cipher> <key> <iv_offset> <dev_path> <start> [<#opt_params> <opt_params>]
  */
 static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 {
@@ -1543,7 +1804,7 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	char dummy;
 
 	static struct dm_arg _args[] = {
-		{0, 1, "Invalid number of feature args"},
+		{0, 3, "Invalid number of feature args"},
 	};
 
 	if (argc < 5) {
@@ -1627,15 +1888,25 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		if (ret)
 			goto bad;
 
-		opt_string = dm_shift_arg(&as);
+		while (opt_params--) {
+			opt_string = dm_shift_arg(&as);
+			if (!opt_string) {
+				ret = -EINVAL;
+				ti->error = "Not enough feature arguments";
+				goto bad;
+			}
 
-		if (opt_params == 1 && opt_string &&
-		    !strcasecmp(opt_string, "allow_discards"))
-			ti->num_discard_requests = 1;
-		else if (opt_params) {
-			ret = -EINVAL;
-			ti->error = "Invalid feature arguments";
-			goto bad;
+			if (!strcasecmp(opt_string, "allow_discards"))
+				ti->num_discard_requests = 1;
+			else if (!strcasecmp(opt_string, "parallel_crypt"))
+				set_bit(DM_CRYPT_PARALLEL, &cc->flags);
+			else if (!strcasecmp(opt_string, "read_bypass"))
+				set_bit(DM_CRYPT_READ_BYPASS, &cc->flags);
+			else {
+				ret = -EINVAL;
+				ti->error = "Invalid feature arguments";
+				goto bad;
+			}
 		}
 	}
 
@@ -1659,6 +1930,25 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		goto bad;
 	}
 
+	if (test_bit(DM_CRYPT_PARALLEL, &cc->flags)) {
+		cc->chunk_pool = mempool_create_kmalloc_pool(MIN_IOS,
+					sizeof(struct dm_crypt_chunk));
+		if (!cc->chunk_pool) {
+			ti->error = "Cannot allocate crypt chunk mempool";
+			goto bad;
+		}
+
+		cc->chunk_queue = alloc_workqueue("kcryptd_chunk",
+						  WQ_UNBOUND|
+						  WQ_CPU_INTENSIVE|
+						  WQ_MEM_RECLAIM,
+						  num_online_cpus());
+		if (!cc->chunk_queue) {
+			ti->error = "Couldn't create kcryptd chunk queue";
+			goto bad;
+		}
+	}
+
 	ti->num_flush_requests = 1;
 	ti->discard_zeroes_data_unsupported = 1;
 
@@ -1704,6 +1994,7 @@ static int crypt_status(struct dm_target *ti, status_type_t type,
 {
 	struct crypt_config *cc = ti->private;
 	unsigned int sz = 0;
+	int num_feature_args = 0;
 
 	switch (type) {
 	case STATUSTYPE_INFO:
@@ -1728,8 +2019,18 @@ static int crypt_status(struct dm_target *ti, status_type_t type,
 		DMEMIT(" %llu %s %llu", (unsigned long long)cc->iv_offset,
 				cc->dev->name, (unsigned long long)cc->start);
 
-		if (ti->num_discard_requests)
-			DMEMIT(" 1 allow_discards");
+		num_feature_args += !!ti->num_discard_requests;
+		num_feature_args += test_bit(DM_CRYPT_PARALLEL, &cc->flags);
+		num_feature_args += test_bit(DM_CRYPT_READ_BYPASS, &cc->flags);
+		if (num_feature_args) {
+			DMEMIT(" %d", num_feature_args);
+			if (ti->num_discard_requests)
+				DMEMIT(" allow_discards");
+			if (test_bit(DM_CRYPT_PARALLEL, &cc->flags))
+				DMEMIT(" parallel_crypt");
+			if (test_bit(DM_CRYPT_READ_BYPASS, &cc->flags))
+				DMEMIT(" read_bypass");
+		}
 
 		break;
 	}
@@ -1827,7 +2128,7 @@ static int crypt_iterate_devices(struct dm_target *ti,
 
 static struct target_type crypt_target = {
 	.name   = "crypt",
-	.version = {1, 11, 0},
+	.version = {1, 12, 0},
 	.module = THIS_MODULE,
 	.ctr    = crypt_ctr,
 	.dtr    = crypt_dtr,
@@ -12,12 +12,25 @@
  * hash device. Setting this greatly improves performance when data and hash
  * are on the same disk on different partitions on devices with poor random
  * access behavior.
+ *
+ * In the file "/sys/module/dm_verity/parameters/parallel_blocks" you can set
+ * the minimum number of data blocks handed to one verification work item.
+ * Bios larger than twice this value are split and their blocks are verified
+ * on several CPUs at once. Zero disables the splitting.
+ *
+ * In the file "/sys/module/dm_verity/parameters/tree_cache_size" you can set
+ * how many bytes of the upper (non-leaf) levels of the hash tree are kept in
+ * memory once verified, for newly created targets. The cached levels are
+ * never read or hashed again.
  */
 
 #include "dm-bufio.h"
 
 #include <linux/module.h>
 #include <linux/device-mapper.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
 #include <crypto/hash.h>
 
 #define DM_MSG_PREFIX			"verity"
@@ -25,6 +38,8 @@
 #define DM_VERITY_IO_VEC_INLINE		16
 #define DM_VERITY_MEMPOOL_SIZE		4
 #define DM_VERITY_DEFAULT_PREFETCH_SIZE	262144
+#define DM_VERITY_DEFAULT_PARALLEL_BLOCKS	8
+#define DM_VERITY_DEFAULT_TREE_CACHE_SIZE	1048576
 
 #define DM_VERITY_MAX_LEVELS		63
 
@@ -32,6 +47,16 @@ static unsigned dm_verity_prefetch_cluster = DM_VERITY_DEFAULT_PREFETCH_SIZE;
 
 module_param_named(prefetch_cluster, dm_verity_prefetch_cluster, uint, S_IRUGO | S_IWUSR);
 
+static unsigned dm_verity_parallel_blocks = DM_VERITY_DEFAULT_PARALLEL_BLOCKS;
+
+module_param_named(parallel_blocks, dm_verity_parallel_blocks, uint, S_IRUGO | S_IWUSR);
+
+static unsigned dm_verity_tree_cache_size = DM_VERITY_DEFAULT_TREE_CACHE_SIZE;
+
+module_param_named(tree_cache_size, dm_verity_tree_cache_size, uint, S_IRUGO | S_IWUSR);
+
+static struct dentry *dm_verity_debugfs_root;
+
 struct dm_verity {
 	struct dm_dev *data_dev;
 	struct dm_dev *hash_dev;
@@ -57,9 +82,28 @@ struct dm_verity {
 
 	mempool_t *io_mempool;	/* mempool of struct dm_verity_io */
 	mempool_t *vec_mempool;	/* mempool of bio vector */
+	mempool_t *part_mempool;	/* mempool of struct dm_verity_part */
 
 	struct workqueue_struct *verify_wq;
 
+	/*
+	 * Verified copies of the upper hash tree blocks, indexed by
+	 * (hash block - hash_start). Entries are filled in once and only
+	 * freed in the destructor.
+	 */
+	u8 **tree_cache;
+	sector_t tree_cache_blocks;
+
+	/* statistics, see verity_stats_show() */
+	struct dentry *debugfs_file;
+	spinlock_t stats_lock;
+	u64 stat_ios;
+	u64 stat_blocks;
+	u64 stat_split_ios;
+	u64 stat_latency_ns;	/* sum over all ios */
+	u64 stat_latency_max_ns;
+	atomic64_t stat_tree_cache_hits;
+
 	/* starting blocks for each tree level. 0 is the lowest level. */
 	sector_t hash_level_block[DM_VERITY_MAX_LEVELS];
 };
@@ -81,6 +125,12 @@ struct dm_verity_io {
 
 	struct work_struct work;
 
+	/* outstanding parts; the last one to finish ends the io */
+	atomic_t pending;
+	int error;
+	bool split;
+	ktime_t verify_start;
+
 	/* A space for short vectors; longer vectors are allocated separately. */
 	struct bio_vec io_vec_inline[DM_VERITY_IO_VEC_INLINE];
 
@@ -91,23 +141,47 @@ struct dm_verity_io {
 	 * u8 real_digest[v->digest_size];
 	 * u8 want_digest[v->digest_size];
 	 *
-	 * To access them use: io_hash_desc(), io_real_digest() and io_want_digest().
+	 * To access them use: io_hash_desc(), io_real_digest() and io_want_digest()
+	 * on the pointer returned by io_scratch().
 	 */
 };
 
-static struct shash_desc *io_hash_desc(struct dm_verity *v, struct dm_verity_io *io)
+/*
+ * A range of blocks of one dm_verity_io that is verified by its own work
+ * item. It is followed by the same variably-sized fields as dm_verity_io.
+ */
+struct dm_verity_part {
+	struct dm_verity_io *io;
+	unsigned first;		/* first block, relative to io->block */
+	unsigned n_blocks;
+	unsigned vector;	/* position of the first block in io->io_vec */
+	unsigned offset;
+	struct work_struct work;
+};
+
+static u8 *io_scratch(struct dm_verity_io *io)
 {
-	return (struct shash_desc *)(io + 1);
+	return (u8 *)(io + 1);
 }
 
-static u8 *io_real_digest(struct dm_verity *v, struct dm_verity_io *io)
+static u8 *part_scratch(struct dm_verity_part *part)
 {
-	return (u8 *)(io + 1) + v->shash_descsize;
+	return (u8 *)(part + 1);
 }
 
-static u8 *io_want_digest(struct dm_verity *v, struct dm_verity_io *io)
+static struct shash_desc *io_hash_desc(struct dm_verity *v, u8 *scratch)
 {
-	return (u8 *)(io + 1) + v->shash_descsize + v->digest_size;
+	return (struct shash_desc *)scratch;
+}
+
+static u8 *io_real_digest(struct dm_verity *v, u8 *scratch)
+{
+	return scratch + v->shash_descsize;
+}
+
+static u8 *io_want_digest(struct dm_verity *v, u8 *scratch)
+{
+	return scratch + v->shash_descsize + v->digest_size;
 }
 
 /*
@@ -174,19 +248,54 @@ static void verity_hash_at_level(struct dm_verity *v, sector_t block, int level,
 		*offset = idx << (v->hash_dev_block_bits - v->hash_per_block_bits);
 }
 
+/*
+ * Return the cached, already verified copy of a hash block or NULL if the
+ * block is not cached.
+ */
+static u8 *verity_tree_cache_get(struct dm_verity *v, sector_t hash_block)
+{
+	if (hash_block - v->hash_start >= v->tree_cache_blocks)
+		return NULL;
+
+	return ACCESS_ONCE(v->tree_cache[hash_block - v->hash_start]);
+}
+
+/*
+ * Keep a copy of a verified upper level hash block. Failing to allocate
+ * the copy is harmless, the block is then read through dm-bufio next time.
+ */
+static void verity_tree_cache_add(struct dm_verity *v, sector_t hash_block,
+				  u8 *data)
+{
+	u8 *copy;
+
+	if (hash_block - v->hash_start >= v->tree_cache_blocks ||
+	    ACCESS_ONCE(v->tree_cache[hash_block - v->hash_start]))
+		return;
+
+	copy = kmalloc(1 << v->hash_dev_block_bits, GFP_NOIO | __GFP_NOWARN);
+	if (!copy)
+		return;
+	memcpy(copy, data, 1 << v->hash_dev_block_bits);
+
+	/* cmpxchg implies a barrier, the copy is visible before the pointer */
+	if (cmpxchg(&v->tree_cache[hash_block - v->hash_start], NULL, copy))
+		kfree(copy);
+}
+
 /*
  * Verify hash of a metadata block pertaining to the specified data block
  * ("block" argument) at a specified level ("level" argument).
  *
- * On successful return, io_want_digest(v, io) contains the hash value for
- * a lower tree level or for the data block (if we're at the lowest leve).
+ * On successful return, io_want_digest(v, scratch) contains the hash value
+ * for a lower tree level or for the data block (if we're at the lowest leve).
  *
  * If "skip_unverified" is true, unverified buffer is skipped and 1 is returned.
  * If "skip_unverified" is false, unverified buffer is hashed and verified
- * against current value of io_want_digest(v, io).
+ * against current value of io_want_digest(v, scratch).
  */
-static int verity_verify_level(struct dm_verity_io *io, sector_t block,
-			       int level, bool skip_unverified)
+static int verity_verify_level(struct dm_verity_io *io, u8 *scratch,
+			       sector_t block, int level, bool skip_unverified)
 {
 	struct dm_verity *v = io->v;
 	struct dm_buffer *buf;
@@ -213,7 +322,7 @@ static int verity_verify_level(struct dm_verity_io *io, sector_t block,
 			goto release_ret_r;
 		}
 
-		desc = io_hash_desc(v, io);
+		desc = io_hash_desc(v, scratch);
 		desc->tfm = v->tfm;
 		desc->flags = CRYPTO_TFM_REQ_MAY_SLEEP;
 		r = crypto_shash_init(desc);
@@ -244,13 +353,13 @@ static int verity_verify_level(struct dm_verity_io *io, sector_t block,
 			}
 		}
 
-		result = io_real_digest(v, io);
+		result = io_real_digest(v, scratch);
 		r = crypto_shash_final(desc, result);
 		if (r < 0) {
 			DMERR("crypto_shash_final failed: %d", r);
 			goto release_ret_r;
 		}
-		if (unlikely(memcmp(result, io_want_digest(v, io), v->digest_size))) {
+		if (unlikely(memcmp(result, io_want_digest(v, scratch), v->digest_size))) {
 			DMERR_LIMIT("metadata block %llu is corrupted",
 				(unsigned long long)hash_block);
 			v->hash_failed = 1;
@@ -260,9 +369,12 @@ static int verity_verify_level(struct dm_verity_io *io, sector_t block,
 			aux->hash_verified = 1;
 	}
 
+	if (level)
+		verity_tree_cache_add(v, hash_block, data);
+
 	data += offset;
 
-	memcpy(io_want_digest(v, io), data, v->digest_size);
+	memcpy(io_want_digest(v, scratch), data, v->digest_size);
 
 	dm_bufio_release(buf);
 	return 0;
@@ -274,16 +386,48 @@ release_ret_r:
 }
 
 /*
- * Verify one "dm_verity_io" structure.
+ * Start the chain verification for a data block at the lowest cached tree
+ * level instead of at the root. Return the level below it, from which the
+ * hash blocks must be read and verified, with the wanted digest loaded.
+ */
+static int verity_tree_cache_start(struct dm_verity *v, u8 *scratch,
+				   sector_t block)
+{
+	int i;
+
+	for (i = 1; i < v->levels; i++) {
+		sector_t hash_block;
+		unsigned offset;
+		u8 *data;
+
+		verity_hash_at_level(v, block, i, &hash_block, &offset);
+		data = verity_tree_cache_get(v, hash_block);
+		if (data) {
+			atomic64_inc(&v->stat_tree_cache_hits);
+			memcpy(io_want_digest(v, scratch), data + offset,
+			       v->digest_size);
+			return i - 1;
+		}
+	}
+
+	memcpy(io_want_digest(v, scratch), v->root_digest, v->digest_size);
+
+	return v->levels - 1;
+}
+
+/*
+ * Verify "n_blocks" blocks of one "dm_verity_io" structure starting with
+ * block "first", whose data begin at "offset" in io->io_vec[vector].
  */
-static int verity_verify_io(struct dm_verity_io *io)
+static int verity_verify_blocks(struct dm_verity_io *io, u8 *scratch,
+				unsigned first, unsigned n_blocks,
+				unsigned vector, unsigned offset)
 {
 	struct dm_verity *v = io->v;
 	unsigned b;
 	int i;
-	unsigned vector = 0, offset = 0;
 
-	for (b = 0; b < io->n_blocks; b++) {
+	for (b = first; b < first + n_blocks; b++) {
 		struct shash_desc *desc;
 		u8 *result;
 		int r;
@@ -297,23 +441,24 @@ static int verity_verify_io(struct dm_verity_io *io)
 			 * function returns 0 and we fall back to whole
 			 * chain verification.
 			 */
-			int r = verity_verify_level(io, io->block + b, 0, true);
+			int r = verity_verify_level(io, scratch, io->block + b,
+						    0, true);
 			if (likely(!r))
 				goto test_block_hash;
 			if (r < 0)
 				return r;
 		}
 
-		memcpy(io_want_digest(v, io), v->root_digest, v->digest_size);
-
-		for (i = v->levels - 1; i >= 0; i--) {
-			int r = verity_verify_level(io, io->block + b, i, false);
+		for (i = verity_tree_cache_start(v, scratch, io->block + b);
+		     i >= 0; i--) {
+			int r = verity_verify_level(io, scratch, io->block + b,
+						    i, false);
 			if (unlikely(r))
 				return r;
 		}
 
 test_block_hash:
-		desc = io_hash_desc(v, io);
+		desc = io_hash_desc(v, scratch);
 		desc->tfm = v->tfm;
 		desc->flags = CRYPTO_TFM_REQ_MAY_SLEEP;
 		r = crypto_shash_init(desc);
@@ -365,21 +510,20 @@ test_block_hash:
 			}
 		}
 
-		result = io_real_digest(v, io);
+		result = io_real_digest(v, scratch);
 		r = crypto_shash_final(desc, result);
 		if (r < 0) {
 			DMERR("crypto_shash_final failed: %d", r);
 			return r;
 		}
-		if (unlikely(memcmp(result, io_want_digest(v, io), v->digest_size))) {
+		if (unlikely(memcmp(result, io_want_digest(v, scratch), v->digest_size))) {
 			DMERR_LIMIT("data block %llu is corrupted",
 				(unsigned long long)(io->block + b));
 			v->hash_failed = 1;
 			return -EIO;
 		}
 	}
-	BUG_ON(vector != io->io_vec_size);
-	BUG_ON(offset);
+	BUG_ON(b == io->n_blocks && (vector != io->io_vec_size || offset));
 
 	return 0;
 }
@@ -403,11 +547,119 @@ static void verity_finish_io(struct dm_verity_io *io, int error)
 	bio_endio(bio, error);
 }
 
+static void verity_account_io(struct dm_verity_io *io)
+{
+	struct dm_verity *v = io->v;
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), io->verify_start));
+
+	spin_lock(&v->stats_lock);
+	v->stat_ios++;
+	v->stat_blocks += io->n_blocks;
+	if (io->split)
+		v->stat_split_ios++;
+	v->stat_latency_ns += ns;
+	if (ns > v->stat_latency_max_ns)
+		v->stat_latency_max_ns = ns;
+	spin_unlock(&v->stats_lock);
+}
+
+/*
+ * Complete one part of the io. The last part to finish ends the io with
+ * the first error any part has hit.
+ */
+static void verity_part_done(struct dm_verity_io *io, int error)
+{
+	if (unlikely(error))
+		cmpxchg(&io->error, 0, error);
+
+	if (!atomic_dec_and_test(&io->pending))
+		return;
+
+	verity_account_io(io);
+	verity_finish_io(io, io->error);
+}
+
+static void verity_part_work(struct work_struct *w)
+{
+	struct dm_verity_part *part = container_of(w, struct dm_verity_part, work);
+	struct dm_verity_io *io = part->io;
+	int r;
+
+	r = verity_verify_blocks(io, part_scratch(part), part->first,
+				 part->n_blocks, part->vector, part->offset);
+	mempool_free(part, io->v->part_mempool);
+	verity_part_done(io, r);
+}
+
+/*
+ * Find where the data of block "b" of the io start in its bio vector.
+ */
+static void verity_io_vec_position(struct dm_verity_io *io, unsigned b,
+				   unsigned *vector, unsigned *offset)
+{
+	unsigned bytes = b << io->v->data_dev_block_bits;
+	unsigned i = 0;
+
+	while (bytes >= io->io_vec[i].bv_len) {
+		bytes -= io->io_vec[i].bv_len;
+		i++;
+	}
+
+	*vector = i;
+	*offset = bytes;
+}
+
+/*
+ * Hand the tail of a large io to other CPUs in parts of at least
+ * "parallel_blocks" blocks. Parts are allocated from the end of the io
+ * without waiting; whatever could not be handed off is returned as the
+ * number of leading blocks the caller must verify itself.
+ */
+static unsigned verity_split_io(struct dm_verity_io *io)
+{
+	struct dm_verity *v = io->v;
+	unsigned min_blocks = ACCESS_ONCE(dm_verity_parallel_blocks);
+	unsigned per_part, end;
+
+	if (!min_blocks || io->n_blocks < 2 * min_blocks ||
+	    num_online_cpus() < 2)
+		return io->n_blocks;
+
+	per_part = max(min_blocks, DIV_ROUND_UP(io->n_blocks, num_online_cpus()));
+	end = io->n_blocks;
+
+	while (end > per_part) {
+		struct dm_verity_part *part;
+		unsigned first = (end - 1) / per_part * per_part;
+
+		part = mempool_alloc(v->part_mempool, GFP_NOWAIT);
+		if (!part)
+			break;
+
+		part->io = io;
+		part->first = first;
+		part->n_blocks = end - first;
+		verity_io_vec_position(io, first, &part->vector, &part->offset);
+
+		io->split = true;
+		atomic_inc(&io->pending);
+		INIT_WORK(&part->work, verity_part_work);
+		queue_work(v->verify_wq, &part->work);
+
+		end = first;
+	}
+
+	return end;
+}
+
 static void verity_work(struct work_struct *w)
 {
 	struct dm_verity_io *io = container_of(w, struct dm_verity_io, work);
+	unsigned n_blocks;
 
-	verity_finish_io(io, verity_verify_io(io));
+	n_blocks = verity_split_io(io);
+	verity_part_done(io, verity_verify_blocks(io, io_scratch(io), 0,
+						  n_blocks, 0, 0));
 }
 
 static void verity_end_io(struct bio *bio, int error)
@@ -419,6 +671,11 @@ static void verity_end_io(struct bio *bio, int error)
 		return;
 	}
 
+	atomic_set(&io->pending, 1);
+	io->error = 0;
+	io->split = false;
+	io->verify_start = ktime_get();
+
 	INIT_WORK(&io->work, verity_work);
 	queue_work(io->v->verify_wq, &io->work);
 }
@@ -426,7 +683,7 @@ static void verity_end_io(struct bio *bio, int error)
 /*
  * Prefetch buffers for the specified io.
  * The root buffer is not prefetched, it is assumed that it will be cached
- * all the time.
+ * all the time. Neither are upper level blocks held in the tree cache.
  */
 static void verity_prefetch_io(struct dm_verity *v, struct dm_verity_io *io)
 {
@@ -437,6 +694,9 @@ static void verity_prefetch_io(struct dm_verity *v, struct dm_verity_io *io)
 		sector_t hash_block_end;
 		verity_hash_at_level(v, io->block, i, &hash_block_start, NULL);
 		verity_hash_at_level(v, io->block + io->n_blocks - 1, i, &hash_block_end, NULL);
+		if (i && verity_tree_cache_get(v, hash_block_start) &&
+		    verity_tree_cache_get(v, hash_block_end))
+			continue;
 		if (!i) {
 			unsigned cluster = *(volatile unsigned *)&dm_verity_prefetch_cluster;
 
@@ -550,6 +810,105 @@ static int verity_status(struct dm_target *ti, status_type_t type,
 	return 0;
 }
 
+static int verity_stats_show(struct seq_file *m, void *unused)
+{
+	struct dm_verity *v = m->private;
+	u64 ios, blocks, split_ios, latency_ns, latency_max_ns;
+	sector_t cached = 0, i;
+
+	spin_lock(&v->stats_lock);
+	ios = v->stat_ios;
+	blocks = v->stat_blocks;
+	split_ios = v->stat_split_ios;
+	latency_ns = v->stat_latency_ns;
+	latency_max_ns = v->stat_latency_max_ns;
+	spin_unlock(&v->stats_lock);
+
+	for (i = 0; i < v->tree_cache_blocks; i++)
+		if (ACCESS_ONCE(v->tree_cache[i]))
+			cached++;
+
+	seq_printf(m, "ios: %llu\n", (unsigned long long)ios);
+	seq_printf(m, "blocks: %llu\n", (unsigned long long)blocks);
+	seq_printf(m, "split_ios: %llu\n", (unsigned long long)split_ios);
+	seq_printf(m, "verify_latency_avg_us: %llu\n", ios ?
+		   (unsigned long long)div64_u64(latency_ns, ios * NSEC_PER_USEC) : 0ULL);
+	seq_printf(m, "verify_latency_max_us: %llu\n",
+		   (unsigned long long)div_u64(latency_max_ns, NSEC_PER_USEC));
+	seq_printf(m, "tree_cache_blocks: %llu/%llu\n",
+		   (unsigned long long)cached,
+		   (unsigned long long)v->tree_cache_blocks);
+	seq_printf(m, "tree_cache_hits: %llu\n",
+		   (unsigned long long)atomic64_read(&v->stat_tree_cache_hits));
+
+	return 0;
+}
+
+static int verity_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, verity_stats_show, inode->i_private);
+}
+
+static const struct file_operations verity_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= verity_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/*
+ * Create /sys/kernel/debug/dm-verity/<dm device>[-<start sector>]. The
+ * statistics are informational only, so failures are ignored.
+ */
+static void verity_create_debugfs(struct dm_verity *v)
+{
+	struct dm_target *ti = v->ti;
+	const char *dev_name = dm_device_name(dm_table_get_md(ti->table));
+	char name[32];
+	struct dentry *d;
+
+	if (IS_ERR_OR_NULL(dm_verity_debugfs_root))
+		return;
+
+	if (ti->begin)
+		snprintf(name, sizeof(name), "%s-%llu", dev_name,
+			 (unsigned long long)ti->begin);
+	else
+		snprintf(name, sizeof(name), "%s", dev_name);
+
+	d = debugfs_create_file(name, S_IRUSR, dm_verity_debugfs_root, v,
+				&verity_stats_fops);
+	if (!IS_ERR_OR_NULL(d))
+		v->debugfs_file = d;
+}
+
+/*
+ * Size the tree cache so that it holds as many of the upper levels as fit
+ * in "tree_cache_size" bytes. Levels are stored top-down starting at
+ * hash_start, so the cached levels form one range of hash blocks.
+ */
+static int verity_alloc_tree_cache(struct dm_verity *v)
+{
+	unsigned long long max_blocks =
+		ACCESS_ONCE(dm_verity_tree_cache_size) >> v->hash_dev_block_bits;
+	int i;
+
+	for (i = 1; i < v->levels; i++)
+		if (v->hash_level_block[i - 1] - v->hash_start <= max_blocks)
+			break;
+	if (i >= v->levels)
+		return 0;
+
+	v->tree_cache = kcalloc(v->hash_level_block[i - 1] - v->hash_start,
+				sizeof(u8 *), GFP_KERNEL);
+	if (!v->tree_cache)
+		return -ENOMEM;
+	v->tree_cache_blocks = v->hash_level_block[i - 1] - v->hash_start;
+
+	return 0;
+}
+
 static int verity_ioctl(struct dm_target *ti, unsigned cmd,
 			unsigned long arg)
 {
@@ -603,10 +962,22 @@ static void verity_io_hints(struct dm_target *ti, struct queue_limits *limits)
 static void verity_dtr(struct dm_target *ti)
 {
 	struct dm_verity *v = ti->private;
+	sector_t i;
+
+	debugfs_remove(v->debugfs_file);
 
 	if (v->verify_wq)
 		destroy_workqueue(v->verify_wq);
 
+	if (v->tree_cache) {
+		for (i = 0; i < v->tree_cache_blocks; i++)
+			kfree(v->tree_cache[i]);
+		kfree(v->tree_cache);
+	}
+
+	if (v->part_mempool)
+		mempool_destroy(v->part_mempool);
+
 	if (v->vec_mempool)
 		mempool_destroy(v->vec_mempool);
 
@@ -664,6 +1035,8 @@ static int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 	}
 	ti->private = v;
 	v->ti = ti;
+	spin_lock_init(&v->stats_lock);
+	atomic64_set(&v->stat_tree_cache_hits, 0);
 
 	if ((dm_table_get_mode(ti->table) & ~FMODE_READ)) {
 		ti->error = "Device must be readonly";
@@ -857,6 +1230,20 @@ static int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 		goto bad;
 	}
 
+	v->part_mempool = mempool_create_kmalloc_pool(DM_VERITY_MEMPOOL_SIZE,
+	  sizeof(struct dm_verity_part) + v->shash_descsize + v->digest_size * 2);
+	if (!v->part_mempool) {
+		ti->error = "Cannot allocate part mempool";
+		r = -ENOMEM;
+		goto bad;
+	}
+
+	r = verity_alloc_tree_cache(v);
+	if (r) {
+		ti->error = "Cannot allocate tree cache";
+		goto bad;
+	}
+
 	/* WQ_UNBOUND greatly improves performance when running on ramdisk */
 	v->verify_wq = alloc_workqueue("kverityd", WQ_CPU_INTENSIVE | WQ_MEM_RECLAIM | WQ_UNBOUND, num_online_cpus());
 	if (!v->verify_wq) {
@@ -865,6 +1252,8 @@ static int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 		goto bad;
 	}
 
+	verity_create_debugfs(v);
+
 	return 0;
 
 bad:
@@ -875,7 +1264,7 @@ bad:
 
 static struct target_type verity_target = {
 	.name		= "verity",
-	.version	= {1, 0, 0},
+	.version	= {1, 1, 0},
 	.module		= THIS_MODULE,
 	.ctr		= verity_ctr,
 	.dtr		= verity_dtr,
@@ -891,9 +1280,13 @@ static int __init dm_verity_init(void)
 {
 	int r;
 
+	dm_verity_debugfs_root = debugfs_create_dir("dm-verity", NULL);
+
 	r = dm_register_target(&verity_target);
-	if (r < 0)
+	if (r < 0) {
 		DMERR("register failed %d", r);
+		debugfs_remove(dm_verity_debugfs_root);
+	}
 
 	return r;
 }
@@ -901,6 +1294,7 @@ static int __init dm_verity_init(void)
 static void __exit dm_verity_exit(void)
 {
 	dm_unregister_target(&verity_target);
+	debugfs_remove(dm_verity_debugfs_root);
 }
 
 module_init(dm_verity_init);
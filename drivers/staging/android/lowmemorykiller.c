@@ -37,6 +37,14 @@
 #include <linux/sched.h>
 #include <linux/rcupdate.h>
 #include <linux/notifier.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
+#include <linux/delay.h>
+#include <linux/slab.h>
 
 #ifdef CONFIG_PANTECH_MORE_DEBUGGING_INFO_ON_KERNEL
 extern void show_meminfo(void);
@@ -58,6 +66,39 @@ static int lowmem_minfree[6] = {
 static int lowmem_minfree_size = 4;
 
 static unsigned long lowmem_deathpending_timeout;
+static struct task_struct *lowmem_deathpending;
+static bool lowmem_reap = true;
+static struct workqueue_struct *lowmem_reap_wq;
+
+/* The last victim and when it was killed, for the kill-to-exit stat */
+static struct task_struct *lowmem_victim;
+static ktime_t lowmem_kill_time;
+
+/* Cost of victim selection and kill-to-free latency, reported in debugfs */
+static struct {
+	atomic_long_t scans;
+	atomic_long_t tasks;
+	atomic_long_t kills;
+	atomic64_t time_ns;
+	u64 max_ns;
+	atomic_long_t reaps;
+	atomic_long_t reap_skipped;
+	atomic_long_t reap_pages;
+	atomic64_t reap_ns;
+	u64 reap_max_ns;
+	atomic_long_t exits;
+	atomic64_t exit_ns;
+	u64 exit_max_ns;
+} lowmem_stats;
+
+static void lowmem_stat_time(atomic64_t *total, u64 *max, ktime_t start)
+{
+	u64 delta = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	atomic64_add(delta, total);
+	if (delta > *max)
+		*max = delta;
+}
 
 #define lowmem_print(level, x...)			\
 	do {						\
@@ -122,13 +163,299 @@ static void dump_tasks(void)
 }
 #endif
 
+/*
+ * Thread group leaders ordered by oom_score_adj, ties broken by address
+ * so that every task has a unique key. The key is cached in the task so
+ * that the tree stays consistent while oom_score_adj is being changed.
+ * The lock is a leaf lock: it is taken with tasklist_lock or siglock
+ * held, and nothing else is taken under it.
+ */
+static struct rb_root lmk_adj_tree = RB_ROOT;
+static DEFINE_SPINLOCK(lmk_adj_tree_lock);
+
+static inline bool lmk_adj_key_less(int adj, struct task_struct *p,
+				    struct task_struct *t)
+{
+	return adj < t->lmk_adj || (adj == t->lmk_adj && p < t);
+}
+
+static void __lmk_adj_tree_insert(struct task_struct *p)
+{
+	struct rb_node **link = &lmk_adj_tree.rb_node;
+	struct rb_node *parent = NULL;
+
+	p->lmk_adj = p->signal->oom_score_adj;
+	while (*link) {
+		parent = *link;
+		if (lmk_adj_key_less(p->lmk_adj, p,
+				     rb_entry(parent, struct task_struct,
+					      lmk_adj_node)))
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&p->lmk_adj_node, parent, link);
+	rb_insert_color(&p->lmk_adj_node, &lmk_adj_tree);
+}
+
+/* Called with tasklist_lock write-locked when @p joins init_task.tasks */
+void lmk_adj_tree_add(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lmk_adj_tree_lock, flags);
+	__lmk_adj_tree_insert(p);
+	spin_unlock_irqrestore(&lmk_adj_tree_lock, flags);
+}
+
+/* Called with tasklist_lock write-locked when @p leaves init_task.tasks */
+void lmk_adj_tree_del(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lmk_adj_tree_lock, flags);
+	if (!RB_EMPTY_NODE(&p->lmk_adj_node)) {
+		rb_erase(&p->lmk_adj_node, &lmk_adj_tree);
+		RB_CLEAR_NODE(&p->lmk_adj_node);
+	}
+	if (lowmem_deathpending == p)
+		lowmem_deathpending = NULL;
+	if (lowmem_victim == p) {
+		lowmem_victim = NULL;
+		atomic_long_inc(&lowmem_stats.exits);
+		lowmem_stat_time(&lowmem_stats.exit_ns,
+				 &lowmem_stats.exit_max_ns, lowmem_kill_time);
+	}
+	spin_unlock_irqrestore(&lmk_adj_tree_lock, flags);
+}
+
+/*
+ * Called with tasklist_lock write-locked when a non-leader thread execs.
+ * The key includes the task address, so @new cannot simply take @old's
+ * place in the tree and is reinserted instead.
+ */
+void lmk_adj_tree_replace(struct task_struct *old, struct task_struct *new)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lmk_adj_tree_lock, flags);
+	if (!RB_EMPTY_NODE(&old->lmk_adj_node)) {
+		rb_erase(&old->lmk_adj_node, &lmk_adj_tree);
+		RB_CLEAR_NODE(&old->lmk_adj_node);
+		__lmk_adj_tree_insert(new);
+	}
+	if (lowmem_deathpending == old)
+		lowmem_deathpending = new;
+	if (lowmem_victim == old)
+		lowmem_victim = new;
+	spin_unlock_irqrestore(&lmk_adj_tree_lock, flags);
+}
+
+/* Called with @p's siglock held after its oom_score_adj has changed */
+void lmk_adj_tree_update(struct task_struct *p)
+{
+	unsigned long flags;
+
+	p = p->group_leader;
+	spin_lock_irqsave(&lmk_adj_tree_lock, flags);
+	if (!RB_EMPTY_NODE(&p->lmk_adj_node) &&
+	    p->lmk_adj != p->signal->oom_score_adj) {
+		rb_erase(&p->lmk_adj_node, &lmk_adj_tree);
+		__lmk_adj_tree_insert(p);
+	}
+	spin_unlock_irqrestore(&lmk_adj_tree_lock, flags);
+}
+
+#define LMK_SCAN_BATCH	16
+
+struct lmk_candidate {
+	struct task_struct *task;
+	int adj;
+};
+
+/*
+ * Take references on up to LMK_SCAN_BATCH tasks with an oom_score_adj of
+ * at least @min_adj, walking down from the highest key below
+ * (@after_adj, @after). @after is only compared, never dereferenced, so
+ * it does not matter if it has exited since the previous batch.
+ */
+static int lmk_adj_tree_collect(struct lmk_candidate *batch, int min_adj,
+				int after_adj, struct task_struct *after)
+{
+	struct rb_node *node, *prev = NULL;
+	unsigned long flags;
+	int n = 0;
+
+	spin_lock_irqsave(&lmk_adj_tree_lock, flags);
+	if (after) {
+		node = lmk_adj_tree.rb_node;
+		while (node) {
+			struct task_struct *t = rb_entry(node,
+					struct task_struct, lmk_adj_node);
+
+			if (t->lmk_adj < after_adj ||
+			    (t->lmk_adj == after_adj && t < after)) {
+				prev = node;
+				node = node->rb_right;
+			} else {
+				node = node->rb_left;
+			}
+		}
+	} else {
+		prev = rb_last(&lmk_adj_tree);
+	}
+	for (node = prev; node && n < LMK_SCAN_BATCH; node = rb_prev(node)) {
+		struct task_struct *t = rb_entry(node, struct task_struct,
+						 lmk_adj_node);
+
+		if (t->lmk_adj < min_adj)
+			break;
+		get_task_struct(t);
+		batch[n].task = t;
+		batch[n].adj = t->lmk_adj;
+		n++;
+	}
+	spin_unlock_irqrestore(&lmk_adj_tree_lock, flags);
+	return n;
+}
+
+/*
+ * A killed task only frees its memory once it runs its exit path, which
+ * can take seconds if it is blocked in D state or frozen. The reaper
+ * unmaps the victim's private memory as soon as the kill has been sent,
+ * the same way MADV_DONTNEED would, so that anonymous pages and swap are
+ * given back straight away.
+ */
+#define LOWMEM_REAP_RETRIES	10
+
+struct lowmem_reap_work {
+	struct work_struct work;
+	struct task_struct *task;
+	struct mm_struct *mm;
+	ktime_t kill_time;
+};
+
+/*
+ * Only reap an mm that is used by the victim's threads alone; anything
+ * else holding mm_users (a vfork child, a transient get_task_mm) makes
+ * us back off and retry. The +1 is our own reference.
+ */
+static bool lowmem_mm_exclusive(struct task_struct *task, struct mm_struct *mm)
+{
+	return atomic_read(&mm->mm_users) <= get_nr_threads(task) + 1;
+}
+
+static unsigned long lowmem_reap_mm(struct mm_struct *mm)
+{
+	struct vm_area_struct *vma;
+	unsigned long before, after;
+
+	before = get_mm_counter(mm, MM_ANONPAGES) +
+		 get_mm_counter(mm, MM_SWAPENTS);
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if (vma->vm_flags & (VM_SHARED | VM_LOCKED | VM_HUGETLB |
+				     VM_PFNMAP))
+			continue;
+		zap_page_range(vma, vma->vm_start, vma->vm_end - vma->vm_start,
+			       NULL);
+	}
+	after = get_mm_counter(mm, MM_ANONPAGES) +
+		get_mm_counter(mm, MM_SWAPENTS);
+	return before > after ? before - after : 0;
+}
+
+static void lowmem_reap_fn(struct work_struct *work)
+{
+	struct lowmem_reap_work *rw =
+		container_of(work, struct lowmem_reap_work, work);
+	struct mm_struct *mm = rw->mm;
+	unsigned long flags;
+	unsigned long pages;
+	int attempts;
+
+	for (attempts = 0; attempts < LOWMEM_REAP_RETRIES; attempts++) {
+		/* mm_users already dropped to zero: exit_mmap has it */
+		if (!atomic_inc_not_zero(&mm->mm_users))
+			goto out;
+		if (lowmem_mm_exclusive(rw->task, mm) &&
+		    down_read_trylock(&mm->mmap_sem)) {
+			pages = lowmem_reap_mm(mm);
+			up_read(&mm->mmap_sem);
+			mmput(mm);
+			goto reaped;
+		}
+		/*
+		 * Don't hold mm_users while we wait, or the victim's own
+		 * exit_mmap would be deferred to us.
+		 */
+		mmput(mm);
+		msleep(100);
+	}
+	lowmem_print(2, "lowmem_reap: gave up on %d (%s)\n",
+		     rw->task->pid, rw->task->comm);
+	atomic_long_inc(&lowmem_stats.reap_skipped);
+	goto out;
+
+reaped:
+	lowmem_print(3, "lowmem_reap: %d (%s) freed %lu pages\n",
+		     rw->task->pid, rw->task->comm, pages);
+	atomic_long_inc(&lowmem_stats.reaps);
+	atomic_long_add(pages, &lowmem_stats.reap_pages);
+	lowmem_stat_time(&lowmem_stats.reap_ns, &lowmem_stats.reap_max_ns,
+			 rw->kill_time);
+
+	/* The memory is back, so stop holding off the next kill */
+	spin_lock_irqsave(&lmk_adj_tree_lock, flags);
+	if (lowmem_deathpending == rw->task->group_leader) {
+		lowmem_deathpending = NULL;
+		lowmem_deathpending_timeout = jiffies - 1;
+	}
+	spin_unlock_irqrestore(&lmk_adj_tree_lock, flags);
+out:
+	mmdrop(mm);
+	put_task_struct(rw->task);
+	kfree(rw);
+}
+
+/* Called with a reference on @task after SIGKILL has been sent to it */
+static void lowmem_queue_reap(struct task_struct *task, ktime_t kill_time)
+{
+	struct lowmem_reap_work *rw;
+	struct mm_struct *mm;
+
+	if (!lowmem_reap || !lowmem_reap_wq)
+		return;
+	rw = kmalloc(sizeof(*rw), GFP_NOWAIT | __GFP_NOWARN);
+	if (!rw) {
+		atomic_long_inc(&lowmem_stats.reap_skipped);
+		return;
+	}
+	task_lock(task);
+	mm = task->mm;
+	if (mm)
+		atomic_inc(&mm->mm_count);
+	task_unlock(task);
+	if (!mm) {
+		kfree(rw);
+		return;
+	}
+	get_task_struct(task);
+	rw->task = task;
+	rw->mm = mm;
+	rw->kill_time = kill_time;
+	INIT_WORK(&rw->work, lowmem_reap_fn);
+	queue_work(lowmem_reap_wq, &rw->work);
+}
+
 static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct task_struct *tsk;
+	struct lmk_candidate batch[LMK_SCAN_BATCH];
+	struct task_struct *after = NULL;
+	int after_adj = OOM_SCORE_ADJ_MAX + 1;
 	struct task_struct *selected = NULL;
 	int rem = 0;
 	int tasksize;
-	int i;
+	int i, n;
 	int min_score_adj = OOM_SCORE_ADJ_MAX + 1;
 	int selected_tasksize = 0;
 	int selected_oom_score_adj;
@@ -139,6 +466,8 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
 						global_page_state(NR_SHMEM);
+	ktime_t start, kill_time;
+	unsigned long flags;
 
 	if (lowmem_adj_size < array_size)
 		array_size = lowmem_adj_size;
@@ -166,62 +495,95 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	}
 	selected_oom_score_adj = min_score_adj;
 
-	rcu_read_lock();
-	for_each_process(tsk) {
-		struct task_struct *p;
-		int oom_score_adj;
+	if (lowmem_deathpending &&
+	    time_before_eq(jiffies, lowmem_deathpending_timeout))
+		return 0;
 
-		if (tsk->flags & PF_KTHREAD)
-			continue;
+	start = ktime_get();
+	atomic_long_inc(&lowmem_stats.scans);
+
+	/*
+	 * Walk down from the highest oom_score_adj. Once a victim has been
+	 * picked only tasks with the same oom_score_adj can beat it, so the
+	 * walk stops at the first lower one.
+	 */
+	while ((n = lmk_adj_tree_collect(batch, selected_oom_score_adj,
+					 after_adj, after)) > 0) {
+		atomic_long_add(n, &lowmem_stats.tasks);
+		after = batch[n - 1].task;
+		after_adj = batch[n - 1].adj;
 
-		//p14291_121211
-		if (time_before_eq(jiffies, lowmem_deathpending_timeout)) {
-			if (test_task_flag(tsk, TIF_MEMDIE)) {
+		for (i = 0; i < n; i++) {
+			struct task_struct *tsk = batch[i].task;
+			struct task_struct *p;
+			int oom_score_adj;
+
+			if (tsk->flags & PF_KTHREAD)
+				goto put;
+
+			//p14291_121211
+			if (time_before_eq(jiffies,
+					   lowmem_deathpending_timeout)) {
+				int dying;
+
+				rcu_read_lock();
+				dying = test_task_flag(tsk, TIF_MEMDIE);
 				rcu_read_unlock();
-				return 0;
+				if (dying) {
+					for (; i < n; i++)
+						put_task_struct(batch[i].task);
+					if (selected)
+						put_task_struct(selected);
+					rem = 0;
+					goto out;
+				}
 			}
-		}
 
-		p = find_lock_task_mm(tsk);
-		if (!p)
-			continue;
+			p = find_lock_task_mm(tsk);
+			if (!p)
+				goto put;
 
-		#if 0 //p14291_121211
-		if (test_tsk_thread_flag(p, TIF_MEMDIE) &&
-		    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
-			task_unlock(p);
-			rcu_read_unlock();
-			return 0;
-		}
-		#endif
-		
-		oom_score_adj = p->signal->oom_score_adj;
-		if (oom_score_adj < min_score_adj) {
+			/* Already killed, and possibly reaped */
+			if (test_tsk_thread_flag(p, TIF_MEMDIE)) {
+				task_unlock(p);
+				goto put;
+			}
+
+			oom_score_adj = p->signal->oom_score_adj;
+			if (oom_score_adj < min_score_adj) {
+				task_unlock(p);
+				goto put;
+			}
+			tasksize = get_mm_rss(p->mm);
+			if (tasksize <= 0) {
+				task_unlock(p);
+				goto put;
+			}
+			if (selected) {
+				if (oom_score_adj < selected_oom_score_adj ||
+				    (oom_score_adj == selected_oom_score_adj &&
+				     tasksize <= selected_tasksize)) {
+					task_unlock(p);
+					goto put;
+				}
+				put_task_struct(selected);
+			}
+			get_task_struct(p);
 			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(p->mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_score_adj < selected_oom_score_adj)
-				continue;
-			if (oom_score_adj == selected_oom_score_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_score_adj = oom_score_adj;
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_score_adj = oom_score_adj;
 #ifdef CONFIG_PANTECH_MORE_DEBUGGING_INFO_ON_KERNEL
-		selected_oom_adj = p->signal->oom_adj;
-		lowmem_print(4, "select %d (%s), oom_adj %d score_adj %d, size %d, to kill\n",
-			     p->pid, p->comm, selected_oom_adj, oom_score_adj, tasksize);
+			selected_oom_adj = p->signal->oom_adj;
+			lowmem_print(4, "select %d (%s), oom_adj %d score_adj %d, size %d, to kill\n",
+				     p->pid, p->comm, selected_oom_adj, oom_score_adj, tasksize);
 #else
-		lowmem_print(4, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_score_adj, tasksize);
+			lowmem_print(4, "select %d (%s), adj %d, size %d, to kill\n",
+				     p->pid, p->comm, oom_score_adj, tasksize);
 #endif
+put:
+			put_task_struct(tsk);
+		}
 	}
 	if (selected) {
 #ifdef CONFIG_PANTECH_MORE_DEBUGGING_INFO_ON_KERNEL
@@ -233,24 +595,104 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			     selected->pid, selected->comm,
 			     selected_oom_score_adj, selected_tasksize);
 #endif
+		spin_lock_irqsave(&lmk_adj_tree_lock, flags);
+		lowmem_deathpending = selected->group_leader;
 		lowmem_deathpending_timeout = jiffies + HZ;
+		lowmem_victim = selected->group_leader;
+		lowmem_kill_time = kill_time = ktime_get();
+		spin_unlock_irqrestore(&lmk_adj_tree_lock, flags);
 #ifdef CONFIG_PANTECH_MORE_DEBUGGING_INFO_ON_KERNEL		
 		if (selected_oom_adj < 7)
 		{
 			show_meminfo();
+			rcu_read_lock();
 			dump_tasks();
+			rcu_read_unlock();
 		}
 #endif
 		send_sig(SIGKILL, selected, 0);
 		set_tsk_thread_flag(selected, TIF_MEMDIE);
+		lowmem_queue_reap(selected, kill_time);
+		put_task_struct(selected);
+		atomic_long_inc(&lowmem_stats.kills);
 		rem -= selected_tasksize;
 	}
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	rcu_read_unlock();
+out:
+	lowmem_stat_time(&lowmem_stats.time_ns, &lowmem_stats.max_ns, start);
 	return rem;
 }
 
+#ifdef CONFIG_DEBUG_FS
+static int lowmem_stats_show(struct seq_file *m, void *unused)
+{
+	seq_printf(m, "scans: %ld\n",
+		   atomic_long_read(&lowmem_stats.scans));
+	seq_printf(m, "tasks_examined: %ld\n",
+		   atomic_long_read(&lowmem_stats.tasks));
+	seq_printf(m, "kills: %ld\n",
+		   atomic_long_read(&lowmem_stats.kills));
+	seq_printf(m, "time_ns: %llu\n",
+		   (unsigned long long)atomic64_read(&lowmem_stats.time_ns));
+	seq_printf(m, "max_time_ns: %llu\n",
+		   (unsigned long long)lowmem_stats.max_ns);
+	seq_printf(m, "reaps: %ld\n",
+		   atomic_long_read(&lowmem_stats.reaps));
+	seq_printf(m, "reap_skipped: %ld\n",
+		   atomic_long_read(&lowmem_stats.reap_skipped));
+	seq_printf(m, "reap_pages: %ld\n",
+		   atomic_long_read(&lowmem_stats.reap_pages));
+	seq_printf(m, "kill_to_reap_ns: %llu\n",
+		   (unsigned long long)atomic64_read(&lowmem_stats.reap_ns));
+	seq_printf(m, "max_kill_to_reap_ns: %llu\n",
+		   (unsigned long long)lowmem_stats.reap_max_ns);
+	seq_printf(m, "exits: %ld\n",
+		   atomic_long_read(&lowmem_stats.exits));
+	seq_printf(m, "kill_to_exit_ns: %llu\n",
+		   (unsigned long long)atomic64_read(&lowmem_stats.exit_ns));
+	seq_printf(m, "max_kill_to_exit_ns: %llu\n",
+		   (unsigned long long)lowmem_stats.exit_max_ns);
+	return 0;
+}
+
+static int lowmem_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lowmem_stats_show, NULL);
+}
+
+static const struct file_operations lowmem_stats_fops = {
+	.open		= lowmem_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static struct dentry *lowmem_debugfs_dir;
+
+static void __init lowmem_debugfs_init(void)
+{
+	lowmem_debugfs_dir = debugfs_create_dir("lowmemorykiller", NULL);
+	if (IS_ERR_OR_NULL(lowmem_debugfs_dir))
+		return;
+	debugfs_create_file("stats", S_IRUGO, lowmem_debugfs_dir, NULL,
+			    &lowmem_stats_fops);
+}
+
+static void lowmem_debugfs_exit(void)
+{
+	debugfs_remove_recursive(lowmem_debugfs_dir);
+}
+#else
+static inline void lowmem_debugfs_init(void)
+{
+}
+
+static inline void lowmem_debugfs_exit(void)
+{
+}
+#endif
+
 static struct shrinker lowmem_shrinker = {
 	.shrink = lowmem_shrink,
 	.seeks = DEFAULT_SEEKS * 16
@@ -258,13 +700,18 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
+	lowmem_reap_wq = alloc_workqueue("lowmem_reap", WQ_MEM_RECLAIM, 1);
 	register_shrinker(&lowmem_shrinker);
+	lowmem_debugfs_init();
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
+	if (lowmem_reap_wq)
+		destroy_workqueue(lowmem_reap_wq);
+	lowmem_debugfs_exit();
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -273,6 +720,7 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(reap, lowmem_reap, bool, S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
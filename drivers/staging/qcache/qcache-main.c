@@ -5,7 +5,8 @@
  *
  * Qcache provides an in-kernel "host implementation" for transcendent memory
  * and, thus indirectly, for cleancache and frontswap.  Qcache includes a
- * page-accessible memory [1] interface, utilizing lzo1x compression:
+ * page-accessible memory [1] interface, utilizing the compressor selected
+ * with the "compressor" module parameter (lzo by default):
  * 1) "compression buddies" ("zbud") is used for ephemeral pages
  * Zbud allows pairs (and potentially,
  * in the future, more than a pair of) compressed pages to be closely linked
@@ -20,7 +21,7 @@
 #include <linux/cpu.h>
 #include <linux/highmem.h>
 #include <linux/list.h>
-#include <linux/lzo.h>
+#include <linux/crypto.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
@@ -67,6 +68,63 @@ static unsigned long zcache_qc_max_used;
 static struct zcache_client zcache_host;
 static struct zcache_client zcache_clients[MAX_CLIENTS];
 
+/*
+ * Per-pool statistics of the local client, i.e. of the cleancache pool of
+ * each mounted filesystem.  Evictions are pages dropped from the pool by
+ * invalidate_page before they could be got back.
+ */
+struct qcache_pool_stats {
+	atomic_long_t puts;
+	atomic_long_t failed_puts;
+	atomic_long_t hits;
+	atomic_long_t misses;
+	atomic_long_t evictions;
+};
+static struct qcache_pool_stats qcache_pool_stats[MAX_POOLS_PER_CLIENT];
+
+#define qcache_pool_stat_inc(_cli_id, _pool_id, _field)			\
+	do {								\
+		if ((_cli_id) == LOCAL_CLIENT)				\
+			atomic_long_inc(&qcache_pool_stats[_pool_id]._field); \
+	} while (0)
+
+/* crypto API for qcache */
+#define QCACHE_COMP_NAME_SZ CRYPTO_MAX_ALG_NAME
+static char qcache_comp_name[QCACHE_COMP_NAME_SZ] = "lzo";
+module_param_string(compressor, qcache_comp_name, QCACHE_COMP_NAME_SZ, 0444);
+MODULE_PARM_DESC(compressor, "Compression algorithm (e.g. lzo, lz4)");
+static struct crypto_comp * __percpu *qcache_comp_pcpu_tfms;
+
+enum comp_op {
+	ZCACHE_COMPOP_COMPRESS,
+	ZCACHE_COMPOP_DECOMPRESS
+};
+
+/*
+ * Callers run with interrupts disabled, so this cpu's transform (and
+ * compression buffer) cannot be used by anybody else meanwhile.
+ */
+static inline int zcache_comp_op(enum comp_op op,
+				const u8 *src, unsigned int slen,
+				u8 *dst, unsigned int *dlen)
+{
+	struct crypto_comp *tfm;
+	int ret = -EINVAL;
+
+	tfm = *per_cpu_ptr(qcache_comp_pcpu_tfms, smp_processor_id());
+	if (unlikely(tfm == NULL))
+		return -ENODEV;
+	switch (op) {
+	case ZCACHE_COMPOP_COMPRESS:
+		ret = crypto_comp_compress(tfm, src, slen, dst, dlen);
+		break;
+	case ZCACHE_COMPOP_DECOMPRESS:
+		ret = crypto_comp_decompress(tfm, src, slen, dst, dlen);
+		break;
+	}
+	return ret;
+}
+
 static inline uint16_t get_client_id_from_client(struct zcache_client *cli)
 {
 	BUG_ON(cli == NULL);
@@ -335,8 +393,7 @@ static void zbud_free_and_delist(struct zbud_hdr *zh)
 }
 
 static struct zbud_hdr *zbud_create(uint16_t client_id, uint16_t pool_id,
-					struct tmem_oid *oid,
-					uint32_t index, struct page *page,
+					struct tmem_oid *oid, uint32_t index,
 					void *cdata, unsigned size)
 {
 	struct zbud_hdr *zh0, *zh1, *zh = NULL;
@@ -363,7 +420,7 @@ static struct zbud_hdr *zbud_create(uint16_t client_id, uint16_t pool_id,
 	zbpg = zbud_alloc_raw_page();
 	if (unlikely(zbpg == NULL))
 		goto out;
-	/* ok, have a page, now compress the data before taking locks */
+	/* ok, have a page, the data was compressed before taking locks */
 	spin_lock(&zbpg->lock);
 	spin_lock(&zbud_budlists_spinlock);
 	list_add_tail(&zbpg->bud_list, &zbud_unbuddied[nchunks].list);
@@ -413,7 +470,7 @@ static int zbud_decompress(struct page *page, struct zbud_hdr *zh)
 {
 	struct zbud_page *zbpg;
 	unsigned budnum = zbud_budnum(zh);
-	size_t out_len = PAGE_SIZE;
+	unsigned int out_len = PAGE_SIZE;
 	char *to_va, *from_va;
 	unsigned size;
 	int ret = 0;
@@ -429,8 +486,9 @@ static int zbud_decompress(struct page *page, struct zbud_hdr *zh)
 	to_va = kmap_atomic(page);
 	size = zh->size;
 	from_va = zbud_data(zh, size);
-	ret = lzo1x_decompress_safe(from_va, size, to_va, &out_len);
-	BUG_ON(ret != LZO_E_OK);
+	ret = zcache_comp_op(ZCACHE_COMPOP_DECOMPRESS, from_va, size,
+				to_va, &out_len);
+	BUG_ON(ret);
 	BUG_ON(out_len != PAGE_SIZE);
 	kunmap_atomic(to_va);
 out:
@@ -789,36 +847,27 @@ static struct tmem_hostops zcache_hostops = {
 static atomic_t zcache_curr_eph_pampd_count = ATOMIC_INIT(0);
 static unsigned long zcache_curr_eph_pampd_count_max;
 
-/* forward reference */
-static int zcache_compress(struct page *from, void **out_va, size_t *out_len);
-
+/*
+ * data is the page already compressed by zcache_put_page(), which does the
+ * compression before tmem takes its locks.
+ */
 static void *zcache_pampd_create(char *data, size_t size, bool raw, int eph,
 				struct tmem_pool *pool, struct tmem_oid *oid,
 				 uint32_t index)
 {
-	void *pampd = NULL, *cdata;
-	size_t clen;
-	int ret;
+	void *pampd = NULL;
 	unsigned long count;
-	struct page *page = (struct page *)(data);
 	struct zcache_client *cli = pool->client;
 	uint16_t client_id = get_client_id_from_client(cli);
 
-	ret = zcache_compress(page, &cdata, &clen);
-	if (ret == 0)
-		goto out;
-	if (clen == 0 || clen > zbud_max_buddy_size()) {
-		zcache_compress_poor++;
-		goto out;
-	}
+	BUG_ON(!raw);
 	pampd = (void *)zbud_create(client_id, pool->pool_id, oid,
-					index, page, cdata, clen);
+					index, data, size);
 	if (pampd != NULL) {
 		count = atomic_inc_return(&zcache_curr_eph_pampd_count);
 		if (count > zcache_curr_eph_pampd_count_max)
 			zcache_curr_eph_pampd_count_max = count;
 	}
-out:
 	return pampd;
 }
 
@@ -895,33 +944,56 @@ static struct tmem_pamops zcache_pamops = {
  * zcache compression/decompression and related per-cpu stuff
  */
 
-#define LZO_WORKMEM_BYTES LZO1X_1_MEM_COMPRESS
-#define LZO_DSTMEM_PAGE_ORDER 1
-static DEFINE_PER_CPU(unsigned char *, zcache_workmem);
+#define ZCACHE_DSTMEM_ORDER 1
 static DEFINE_PER_CPU(unsigned char *, zcache_dstmem);
 
-static int zcache_compress(struct page *from, void **out_va, size_t *out_len)
+static int zcache_compress(struct page *from, void **out_va,
+				unsigned int *out_len)
 {
 	int ret = 0;
 	unsigned char *dmem = __get_cpu_var(zcache_dstmem);
-	unsigned char *wmem = __get_cpu_var(zcache_workmem);
 	char *from_va;
 
 	BUG_ON(!irqs_disabled());
-	if (unlikely(dmem == NULL || wmem == NULL))
+	if (unlikely(dmem == NULL))
 		goto out;  /* no buffer, so can't compress */
+	*out_len = PAGE_SIZE << ZCACHE_DSTMEM_ORDER;
 	from_va = kmap_atomic(from);
 	mb();
-	ret = lzo1x_1_compress(from_va, PAGE_SIZE, dmem, out_len, wmem);
-	BUG_ON(ret != LZO_E_OK);
-	*out_va = dmem;
+	ret = zcache_comp_op(ZCACHE_COMPOP_COMPRESS, from_va, PAGE_SIZE, dmem,
+				out_len);
 	kunmap_atomic(from_va);
+	if (ret)
+		return 0;
+	*out_va = dmem;
 	ret = 1;
 out:
 	return ret;
 }
 
 #ifdef CONFIG_SYSFS
+static int zcache_show_pool_stats(char *buf)
+{
+	struct qcache_pool_stats *st;
+	char *p = buf;
+	int i;
+
+	p += sprintf(p, "pool       puts failed_puts       hits     misses"
+			"  evictions\n");
+	for (i = 0; i < MAX_POOLS_PER_CLIENT; i++) {
+		if (zcache_host.tmem_pools[i] == NULL)
+			continue;
+		st = &qcache_pool_stats[i];
+		p += sprintf(p, "%4d %10ld %11ld %10ld %10ld %10ld\n", i,
+			atomic_long_read(&st->puts),
+			atomic_long_read(&st->failed_puts),
+			atomic_long_read(&st->hits),
+			atomic_long_read(&st->misses),
+			atomic_long_read(&st->evictions));
+	}
+	return p - buf;
+}
+
 #define ZCACHE_SYSFS_RO(_name) \
 	static ssize_t zcache_##_name##_show(struct kobject *kobj, \
 				struct kobj_attribute *attr, char *buf) \
@@ -985,6 +1057,7 @@ ZCACHE_SYSFS_RO_CUSTOM(zbud_unbuddied_list_counts,
 			zbud_show_unbuddied_list_counts);
 ZCACHE_SYSFS_RO_CUSTOM(zbud_cumul_chunk_counts,
 			zbud_show_cumul_chunk_counts);
+ZCACHE_SYSFS_RO_CUSTOM(pool_stats, zcache_show_pool_stats);
 
 static struct attribute *qcache_attrs[] = {
 	&zcache_curr_obj_count_attr.attr,
@@ -1015,6 +1088,7 @@ static struct attribute *qcache_attrs[] = {
 	&zcache_qc_freed_attr.attr,
 	&zcache_qc_used_attr.attr,
 	&zcache_qc_max_used_attr.attr,
+	&zcache_pool_stats_attr.attr,
 	NULL,
 };
 
@@ -1033,23 +1107,37 @@ static int zcache_put_page(int cli_id, int pool_id, struct tmem_oid *oidp,
 				uint32_t index, struct page *page)
 {
 	struct tmem_pool *pool;
+	void *cdata = NULL;
+	unsigned int clen = 0;
 	int ret = -1;
 
 	BUG_ON(!irqs_disabled());
 	pool = zcache_get_pool_by_id(cli_id, pool_id);
 	if (unlikely(pool == NULL))
 		goto out;
-	if (!zcache_freeze && zcache_do_preload(pool) == 0) {
+	qcache_pool_stat_inc(cli_id, pool_id, puts);
+	/*
+	 * Compress into this cpu's buffer before tmem takes the pool locks,
+	 * so concurrent puts and gets of the pool do not wait on it.
+	 */
+	if (!zcache_freeze && zcache_compress(page, &cdata, &clen) &&
+			(clen == 0 || clen > zbud_max_buddy_size())) {
+		zcache_compress_poor++;
+		cdata = NULL;
+	}
+	if (cdata && zcache_do_preload(pool) == 0) {
 		/* preload does preempt_disable on success */
-		ret = tmem_put(pool, oidp, index, (char *)(page),
-				PAGE_SIZE, 0, is_ephemeral(pool));
+		ret = tmem_put(pool, oidp, index, cdata, clen, 1,
+				is_ephemeral(pool));
 		if (ret < 0) {
 			zcache_failed_eph_puts++;
+			qcache_pool_stat_inc(cli_id, pool_id, failed_puts);
 		}
 		zcache_put_pool(pool);
 		preempt_enable_no_resched();
 	} else {
 		zcache_put_to_flush++;
+		qcache_pool_stat_inc(cli_id, pool_id, failed_puts);
 		if (atomic_read(&pool->obj_count) > 0)
 			/* the put fails whether the flush succeeds or not */
 			(void)tmem_flush_page(pool, oidp, index);
@@ -1073,6 +1161,10 @@ static int zcache_get_page(int cli_id, int pool_id, struct tmem_oid *oidp,
 		if (atomic_read(&pool->obj_count) > 0)
 			ret = tmem_get(pool, oidp, index, (char *)(page),
 					&size, 0, is_ephemeral(pool));
+		if (ret == 0)
+			qcache_pool_stat_inc(cli_id, pool_id, hits);
+		else
+			qcache_pool_stat_inc(cli_id, pool_id, misses);
 		zcache_put_pool(pool);
 	}
 	local_irq_restore(flags);
@@ -1092,6 +1184,8 @@ static int zcache_flush_page(int cli_id, int pool_id,
 	if (likely(pool != NULL)) {
 		if (atomic_read(&pool->obj_count) > 0)
 			ret = tmem_flush_page(pool, oidp, index);
+		if (ret >= 0)
+			qcache_pool_stat_inc(cli_id, pool_id, evictions);
 		zcache_put_pool(pool);
 	}
 	if (ret >= 0)
@@ -1185,6 +1279,9 @@ static int zcache_new_pool(uint16_t cli_id, uint32_t flags)
 	atomic_set(&pool->refcount, 0);
 	pool->client = cli;
 	pool->pool_id = poolid;
+	if (cli_id == LOCAL_CLIENT)
+		memset(&qcache_pool_stats[poolid], 0,
+			sizeof(qcache_pool_stats[poolid]));
 	tmem_new_pool(pool, flags);
 	cli->tmem_pools[poolid] = pool;
 	pr_info("qcache: created %s tmem pool, id=%d, client=%d\n",
@@ -1288,6 +1385,23 @@ struct cleancache_ops zcache_cleancache_register_ops(void)
 	return old_ops;
 }
 
+static int __init qcache_comp_init(void)
+{
+	if (!crypto_has_comp(qcache_comp_name, 0, 0)) {
+		pr_info("qcache: %s not supported, falling back to lzo\n",
+			qcache_comp_name);
+		strcpy(qcache_comp_name, "lzo");
+		if (!crypto_has_comp(qcache_comp_name, 0, 0))
+			return -ENODEV;
+	}
+	pr_info("qcache: using %s compressor\n", qcache_comp_name);
+
+	qcache_comp_pcpu_tfms = alloc_percpu(struct crypto_comp *);
+	if (!qcache_comp_pcpu_tfms)
+		return -ENOMEM;
+	return 0;
+}
+
 static int __init qcache_init(void)
 {
 	int ret = 0;
@@ -1311,15 +1425,25 @@ static int __init qcache_init(void)
 	if (!qc->pages)
 		goto out;
 
+	ret = qcache_comp_init();
+	if (ret) {
+		pr_err("qcache: compressor initialization failed\n");
+		goto out;
+	}
+
 	tmem_register_hostops(&zcache_hostops);
 	tmem_register_pamops(&zcache_pamops);
-	for_each_online_cpu(cpu) {
+	/*
+	 * Set up every possible cpu, cpus brought online later would
+	 * otherwise be left without a buffer and never compress.
+	 */
+	for_each_possible_cpu(cpu) {
 		per_cpu(zcache_dstmem, cpu) = (void *)__get_free_pages(
-			GFP_KERNEL | __GFP_REPEAT,
-			LZO_DSTMEM_PAGE_ORDER),
-		per_cpu(zcache_workmem, cpu) =
-			kzalloc(LZO1X_MEM_COMPRESS,
-				GFP_KERNEL | __GFP_REPEAT);
+			GFP_KERNEL | __GFP_REPEAT, ZCACHE_DSTMEM_ORDER);
+		*per_cpu_ptr(qcache_comp_pcpu_tfms, cpu) =
+			crypto_alloc_comp(qcache_comp_name, 0, 0);
+		if (IS_ERR(*per_cpu_ptr(qcache_comp_pcpu_tfms, cpu)))
+			*per_cpu_ptr(qcache_comp_pcpu_tfms, cpu) = NULL;
 	}
 	zcache_objnode_cache = kmem_cache_create("zcache_objnode",
 				sizeof(struct tmem_objnode), 0, 0, NULL);
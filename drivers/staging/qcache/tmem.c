@@ -649,7 +649,11 @@ int tmem_get(struct tmem_pool *pool, struct tmem_oid *oidp, uint32_t index,
 			obj = NULL;
 		}
 	}
-	if (tmem_pamops.is_remote(pampd)) {
+	/*
+	 * Once deleted from the object the pampd can't be reached by anybody
+	 * else, so it is decompressed without holding the hashbucket lock.
+	 */
+	if (free || tmem_pamops.is_remote(pampd)) {
 		lock_held = false;
 		spin_unlock(&hb->lock);
 	}
@@ -0,0 +1,90 @@
+/*
+ * Compressed RAM block device - compression backends
+ *
+ * Copyright (C) 2014 Sergey Senozhatsky.
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZCOMP_H_
+#define _ZCOMP_H_
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+struct zcomp_strm {
+	/* compression/decompression buffer */
+	void *buffer;
+	/*
+	 * The private data of the compression stream, only compression
+	 * stream backend can touch this (e.g. compression algorithm
+	 * working memory)
+	 */
+	void *private;
+	/* used in the idle stream list */
+	struct list_head list;
+};
+
+/* static compression backend */
+struct zcomp_backend {
+	/* acceleration is only a hint, backends may ignore it */
+	int (*compress)(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *private, int acceleration);
+
+	int (*decompress)(const unsigned char *src, size_t src_len,
+			unsigned char *dst);
+
+	void *(*create)(void);
+	void (*destroy)(void *private);
+
+	const char *name;
+};
+
+/*
+ * dynamic per-device compression frontend
+ *
+ * Streams are allocated on demand, up to max_strm of them, so that
+ * writers on different CPUs can compress in parallel. Writers that
+ * find no idle stream once the limit is reached sleep on strm_wait.
+ */
+struct zcomp {
+	/* protect strm list and counters */
+	spinlock_t strm_lock;
+	/* max possible number of zstrm streams */
+	int max_strm;
+	/* number of available zstrm streams */
+	int avail_strm;
+	/* list of idle zstrm streams */
+	struct list_head idle_strm;
+	wait_queue_head_t strm_wait;
+	/* no. of times a writer had to wait for an idle stream */
+	u64 strm_waits;
+	/* speed/ratio trade-off passed to the backend, 1 is the default */
+	int acceleration;
+	struct zcomp_backend *backend;
+};
+
+ssize_t zcomp_available_show(const char *comp, char *buf);
+bool zcomp_available_algorithm(const char *comp);
+
+struct zcomp *zcomp_create(const char *comp, int max_strm);
+void zcomp_destroy(struct zcomp *comp);
+
+void zcomp_set_max_streams(struct zcomp *comp, int num_strm);
+u64 zcomp_strm_waits(struct zcomp *comp);
+void zcomp_set_acceleration(struct zcomp *comp, int acceleration);
+
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp);
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm);
+
+int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
+		const unsigned char *src, size_t *dst_len);
+
+int zcomp_decompress(struct zcomp *comp, const unsigned char *src,
+		size_t src_len, unsigned char *dst);
+#endif /* _ZCOMP_H_ */
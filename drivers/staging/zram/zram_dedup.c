@@ -0,0 +1,138 @@
+/*
+ * Compressed RAM block device - deduplication of identical pages
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#include <linux/kernel.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+
+/* Average number of table entries per hash bucket on a full disk */
+#define ZRAM_DEDUP_ENTRIES_PER_BUCKET	4
+
+static struct hlist_head *zram_dedup_bucket(struct zram *zram, u32 checksum)
+{
+	return &zram->dedup_hash[checksum & (zram->dedup_nr_buckets - 1)];
+}
+
+int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	size_t nr_buckets;
+
+	nr_buckets = num_pages / ZRAM_DEDUP_ENTRIES_PER_BUCKET;
+	nr_buckets = roundup_pow_of_two(max_t(size_t, nr_buckets, 1));
+
+	zram->dedup_hash = vzalloc(nr_buckets * sizeof(*zram->dedup_hash));
+	if (!zram->dedup_hash)
+		return -ENOMEM;
+
+	zram->dedup_nr_buckets = nr_buckets;
+	spin_lock_init(&zram->dedup_lock);
+
+	return 0;
+}
+
+/* All entries must have been put by the time this is called */
+void zram_dedup_fini(struct zram *zram)
+{
+	vfree(zram->dedup_hash);
+	zram->dedup_hash = NULL;
+	zram->dedup_nr_buckets = 0;
+}
+
+/* Checksum of the compressed object, used as the hash key */
+u32 zram_dedup_checksum(const unsigned char *mem, size_t len)
+{
+	return jhash(mem, len, 0);
+}
+
+/*
+ * Look for an object which compressed to exactly @len bytes at @mem.
+ * On a hit, a reference is taken on the returned entry.
+ */
+struct zram_entry *zram_dedup_find(struct zram *zram,
+		const unsigned char *mem, size_t len, u32 checksum)
+{
+	struct hlist_node *pos;
+	struct zram_entry *entry;
+	unsigned char *cmem;
+	int match;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_for_each_entry(entry, pos,
+			zram_dedup_bucket(zram, checksum), node) {
+		if (entry->checksum != checksum || entry->size != len)
+			continue;
+
+		cmem = zs_map_object(zram->mem_pool, entry->handle);
+		match = !memcmp(cmem + sizeof(struct zobj_header), mem, len);
+		zs_unmap_object(zram->mem_pool, entry->handle);
+
+		if (match) {
+			entry->refcount++;
+			spin_unlock(&zram->dedup_lock);
+			return entry;
+		}
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	return NULL;
+}
+
+/*
+ * Start tracking a freshly stored object so that later writes of the
+ * same content can share it. Returns NULL if no memory is available,
+ * in which case the caller keeps using the bare handle.
+ */
+struct zram_entry *zram_dedup_insert(struct zram *zram, void *handle,
+		size_t len, u32 checksum)
+{
+	struct zram_entry *entry;
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->handle = handle;
+	entry->checksum = checksum;
+	entry->size = len;
+	entry->refcount = 1;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_add_head(&entry->node, zram_dedup_bucket(zram, checksum));
+	spin_unlock(&zram->dedup_lock);
+
+	return entry;
+}
+
+/*
+ * Drop a reference and free the object along with the last one.
+ * Returns true if the object was freed, false if it is still shared.
+ */
+bool zram_dedup_put(struct zram *zram, struct zram_entry *entry)
+{
+	unsigned long refcount;
+
+	spin_lock(&zram->dedup_lock);
+	refcount = --entry->refcount;
+	if (!refcount)
+		hlist_del(&entry->node);
+	spin_unlock(&zram->dedup_lock);
+
+	if (refcount)
+		return false;
+
+	zs_free(zram->mem_pool, entry->handle);
+	kfree(entry);
+	return true;
+}
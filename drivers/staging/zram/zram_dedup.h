@@ -0,0 +1,42 @@
+/*
+ * Compressed RAM block device - deduplication of identical pages
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZRAM_DEDUP_H_
+#define _ZRAM_DEDUP_H_
+
+#include <linux/list.h>
+#include <linux/types.h>
+
+struct zram;
+
+/*
+ * A compressed object shared by all table entries whose page content
+ * compressed to the very same bytes. Table entries flagged ZRAM_DEDUP
+ * point to one of these instead of pointing to the zsmalloc handle.
+ */
+struct zram_entry {
+	struct hlist_node node;
+	void *handle;
+	u32 checksum;
+	u16 size;		/* object size (excluding header) */
+	unsigned long refcount;
+};
+
+int zram_dedup_init(struct zram *zram, size_t num_pages);
+void zram_dedup_fini(struct zram *zram);
+
+u32 zram_dedup_checksum(const unsigned char *mem, size_t len);
+struct zram_entry *zram_dedup_find(struct zram *zram,
+		const unsigned char *mem, size_t len, u32 checksum);
+struct zram_entry *zram_dedup_insert(struct zram *zram, void *handle,
+		size_t len, u32 checksum);
+bool zram_dedup_put(struct zram *zram, struct zram_entry *entry);
+
+#endif
@@ -26,18 +26,20 @@
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
 #include <linux/device.h>
+#include <linux/err.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "zram_drv.h"
 
 /* Globals */
 static int zram_major;
 struct zram *zram_devices;
+static const char *default_compressor = "lzo";
 
 /* Module params (documentation at end) */
 static unsigned int num_devices;
@@ -89,21 +91,50 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+/*
+ * Check whether the page consists of a single repeated machine word
+ * and, if so, return that word in @element.
+ */
+static int page_same_filled(void *ptr, unsigned long *element)
 {
-	unsigned int pos;
+	unsigned int pos, last_pos;
 	unsigned long *page;
+	unsigned long val;
 
 	page = (unsigned long *)ptr;
+	last_pos = PAGE_SIZE / sizeof(*page) - 1;
+	val = page[0];
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	/* Most pages differ somewhere: try the far end first */
+	if (val != page[last_pos])
+		return 0;
+
+	for (pos = 1; pos < last_pos; pos++) {
+		if (val != page[pos])
 			return 0;
 	}
 
+	*element = val;
 	return 1;
 }
 
+static void zram_fill_page(void *ptr, unsigned int len,
+			   unsigned long element)
+{
+	unsigned int pos;
+	unsigned long *page;
+
+	/* Zero and 0xff..ff style fills can use the optimised memset */
+	if (element == (element & 0xff) * (~0UL / 0xff)) {
+		memset(ptr, element & 0xff, len);
+		return;
+	}
+
+	page = (unsigned long *)ptr;
+	for (pos = 0; pos < len / sizeof(*page); pos++)
+		page[pos] = element;
+}
+
 static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 {
 	if (!zram->disksize) {
@@ -133,10 +164,251 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+/* Returns the zsmalloc handle of a compressed page */
+static void *zram_get_handle(struct zram *zram, u32 index)
+{
+	void *handle = zram->table[index].handle;
+
+	if (zram_test_flag(zram, index, ZRAM_DEDUP))
+		return ((struct zram_entry *)handle)->handle;
+	return handle;
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+/*
+ * Backing device support: incompressible and idle pages can be moved
+ * out of RAM to a block device. Written back slots are flagged
+ * ZRAM_WB and keep their block index in table.element. Block 0 is
+ * never handed out so that a valid index is never zero.
+ */
+static unsigned long zram_alloc_bdev_block(struct zram *zram)
+{
+	unsigned long blk_idx;
+
+	spin_lock(&zram->bitmap_lock);
+	blk_idx = find_next_zero_bit(zram->bitmap, zram->nr_pages, 1);
+	if (blk_idx == zram->nr_pages) {
+		spin_unlock(&zram->bitmap_lock);
+		return 0;
+	}
+	set_bit(blk_idx, zram->bitmap);
+	spin_unlock(&zram->bitmap_lock);
+
+	return blk_idx;
+}
+
+static void zram_free_bdev_block(struct zram *zram, unsigned long blk_idx)
+{
+	spin_lock(&zram->bitmap_lock);
+	WARN_ON_ONCE(!test_bit(blk_idx, zram->bitmap));
+	clear_bit(blk_idx, zram->bitmap);
+	spin_unlock(&zram->bitmap_lock);
+}
+
+static void zram_bdev_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+/* Synchronously read or write one page worth of the backing device */
+static int zram_bdev_rw_page(struct zram *zram, struct page *page,
+			     unsigned long blk_idx, int rw)
+{
+	int ret;
+	struct bio *bio;
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_sector = blk_idx << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_bdev = zram->bdev;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+	bio->bi_end_io = zram_bdev_end_io;
+	bio->bi_private = &done;
+
+	submit_bio(rw == READ ? READ_SYNC : WRITE_SYNC, bio);
+	wait_for_completion(&done);
+
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+
+	if (rw == READ)
+		zram_stat64_inc(zram, &zram->stats.bd_reads);
+	else
+		zram_stat64_inc(zram, &zram->stats.bd_writes);
+
+	return ret;
+}
+
+struct zram_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk_idx;
+	int ret;
+};
+
+static void zram_sync_read(struct work_struct *work)
+{
+	struct zram_work *zw = container_of(work, struct zram_work, work);
+
+	zw->ret = zram_bdev_rw_page(zw->zram, zw->page, zw->blk_idx, READ);
+}
+
+/*
+ * Reads are issued from our make_request function, where bios we
+ * submit are only queued on current->bio_list until we return. Hand
+ * the read over to a worker so that waiting for it cannot deadlock.
+ */
+static int zram_read_from_bdev(struct zram *zram, struct page *page,
+			       unsigned long blk_idx)
+{
+	struct zram_work work;
+
+	work.zram = zram;
+	work.page = page;
+	work.blk_idx = blk_idx;
+
+	INIT_WORK_ONSTACK(&work.work, zram_sync_read);
+	queue_work(system_unbound_wq, &work.work);
+	flush_work(&work.work);
+	destroy_work_on_stack(&work.work);
+
+	return work.ret;
+}
+
+void zram_reset_bdev(struct zram *zram)
+{
+	if (!zram->backing_dev)
+		return;
+
+	set_blocksize(zram->bdev, zram->old_block_size);
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	filp_close(zram->backing_dev, NULL);
+	vfree(zram->bitmap);
+
+	zram->backing_dev = NULL;
+	zram->bdev = NULL;
+	zram->bitmap = NULL;
+	zram->nr_pages = 0;
+}
+
+/* Must be called with init_lock held for writing, before init */
+int zram_set_backing_dev(struct zram *zram, const char *file_name)
+{
+	int ret;
+	unsigned long nr_pages;
+	unsigned long *bitmap = NULL;
+	struct file *backing_dev;
+	struct inode *inode;
+	struct block_device *bdev;
+
+	backing_dev = filp_open(file_name, O_RDWR | O_LARGEFILE, 0);
+	if (IS_ERR(backing_dev))
+		return PTR_ERR(backing_dev);
+
+	inode = backing_dev->f_mapping->host;
+
+	/* Only block devices (partitions or loop devices) are supported */
+	if (!S_ISBLK(inode->i_mode)) {
+		ret = -ENOTBLK;
+		goto out_close;
+	}
+
+	bdev = bdgrab(I_BDEV(inode));
+	ret = blkdev_get(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL, zram);
+	if (ret < 0)
+		goto out_close;
+
+	nr_pages = i_size_read(inode) >> PAGE_SHIFT;
+	if (nr_pages < 2) {
+		ret = -EINVAL;
+		goto out_put;
+	}
+
+	bitmap = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+	if (!bitmap) {
+		ret = -ENOMEM;
+		goto out_put;
+	}
+
+	zram_reset_bdev(zram);
+
+	zram->old_block_size = block_size(bdev);
+	ret = set_blocksize(bdev, PAGE_SIZE);
+	if (ret)
+		goto out_free;
+
+	zram->backing_dev = backing_dev;
+	zram->bdev = bdev;
+	zram->bitmap = bitmap;
+	zram->nr_pages = nr_pages;
+	pr_info("setup backing device %s\n", file_name);
+
+	return 0;
+
+out_free:
+	vfree(bitmap);
+out_put:
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+out_close:
+	filp_close(backing_dev, NULL);
+
+	return ret;
+}
+
+/* Must be called with init_lock held */
+void zram_mark_idle(struct zram *zram)
+{
+	size_t index;
+
+	write_lock(&zram->tb_lock);
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		if (zram->table[index].handle ||
+		    zram_test_flag(zram, index, ZRAM_ZERO))
+			zram_set_flag(zram, index, ZRAM_IDLE);
+	}
+	write_unlock(&zram->tb_lock);
+}
+
+#else
+static inline void zram_free_bdev_block(struct zram *zram,
+					unsigned long blk_idx) {}
+static inline int zram_read_from_bdev(struct zram *zram, struct page *page,
+				      unsigned long blk_idx)
+{
+	return -EIO;
+}
+#endif
+
+/* Must be called with tb_lock held for writing */
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	void *handle = zram->table[index].handle;
 
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_free_bdev_block(zram, zram->table[index].element);
+		zram->table[index].element = 0;
+		zram_stat_dec(&zram->stats.bd_count);
+		return;
+	}
+
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		zram->table[index].element = 0;
+		zram_stat_dec(&zram->stats.pages_same);
+		return;
+	}
+
 	if (unlikely(!handle)) {
 		/*
 		 * No memory is allocated for zero filled pages.
@@ -156,7 +428,14 @@ static void zram_free_page(struct zram *zram, size_t index)
 		goto out;
 	}
 
-	zs_free(zram->mem_pool, handle);
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		if (!zram_dedup_put(zram, handle))
+			zram_stat64_sub(zram, &zram->stats.dup_data_size,
+					zram->table[index].size);
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+	} else {
+		zs_free(zram->mem_pool, handle);
+	}
 
 	if (zram->table[index].size <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
@@ -170,13 +449,13 @@ out:
 	zram->table[index].size = 0;
 }
 
-static void handle_zero_page(struct bio_vec *bvec)
+static void handle_same_page(struct bio_vec *bvec, unsigned long element)
 {
 	struct page *page = bvec->bv_page;
 	void *user_mem;
 
 	user_mem = kmap_atomic(page);
-	memset(user_mem + bvec->bv_offset, 0, bvec->bv_len);
+	zram_fill_page(user_mem + bvec->bv_offset, bvec->bv_len, element);
 	kunmap_atomic(user_mem);
 
 	flush_dcache_page(page);
@@ -203,127 +482,250 @@ static inline int is_partial_io(struct bio_vec *bvec)
 	return bvec->bv_len != PAGE_SIZE;
 }
 
+/* Read a written back page into the (possibly partial) bio vector */
+static int zram_bvec_read_bdev(struct zram *zram, struct bio_vec *bvec,
+			       unsigned long blk_idx, int offset)
+{
+	int ret;
+	struct page *page = bvec->bv_page;
+	unsigned char *user_mem, *src;
+
+	if (is_partial_io(bvec)) {
+		page = alloc_page(GFP_NOIO);
+		if (!page)
+			return -ENOMEM;
+	}
+
+	ret = zram_read_from_bdev(zram, page, blk_idx);
+
+	if (is_partial_io(bvec)) {
+		if (!ret) {
+			user_mem = kmap_atomic(bvec->bv_page);
+			src = kmap_atomic(page);
+			memcpy(user_mem + bvec->bv_offset, src + offset,
+			       bvec->bv_len);
+			kunmap_atomic(src);
+			kunmap_atomic(user_mem);
+		}
+		__free_page(page);
+	}
+
+	if (unlikely(ret)) {
+		pr_err("Backing device read failed! err=%d, block=%lu\n",
+		       ret, blk_idx);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return ret;
+	}
+
+	flush_dcache_page(bvec->bv_page);
+
+	return 0;
+}
+
 static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 			  u32 index, int offset, struct bio *bio)
 {
-	int ret;
-	size_t clen;
+	int ret = 0;
+	void *handle;
 	struct page *page;
 	struct zobj_header *zheader;
 	unsigned char *user_mem, *cmem, *uncmem = NULL;
 
 	page = bvec->bv_page;
 
+	if (is_partial_io(bvec)) {
+		/* Use  a temporary buffer to decompress the page */
+		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		if (!uncmem) {
+			pr_info("Error allocating temp memory!\n");
+			return -ENOMEM;
+		}
+	}
+
+	read_lock(&zram->tb_lock);
+
+	/*
+	 * The page is being accessed, so it is no longer idle. Clearing
+	 * the flag under the read lock is fine: concurrent readers of the
+	 * same slot only ever clear it too.
+	 */
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		unsigned long blk_idx = zram->table[index].element;
+
+		read_unlock(&zram->tb_lock);
+		if (is_partial_io(bvec))
+			kfree(uncmem);
+		return zram_bvec_read_bdev(zram, bvec, blk_idx, offset);
+	}
+
 	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-		handle_zero_page(bvec);
-		return 0;
+		handle_same_page(bvec, 0);
+		goto out;
+	}
+
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		handle_same_page(bvec, zram->table[index].element);
+		goto out;
 	}
 
 	/* Requested page is not present in compressed area */
 	if (unlikely(!zram->table[index].handle)) {
 		pr_debug("Read before write: sector=%lu, size=%u",
 			 (ulong)(bio->bi_sector), bio->bi_size);
-		handle_zero_page(bvec);
-		return 0;
+		handle_same_page(bvec, 0);
+		goto out;
 	}
 
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		handle_uncompressed_page(zram, bvec, index, offset);
-		return 0;
-	}
-
-	if (is_partial_io(bvec)) {
-		/* Use  a temporary buffer to decompress the page */
-		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
-		if (!uncmem) {
-			pr_info("Error allocating temp memory!\n");
-			return -ENOMEM;
-		}
+		goto out;
 	}
 
 	user_mem = kmap_atomic(page);
 	if (!is_partial_io(bvec))
 		uncmem = user_mem;
-	clen = PAGE_SIZE;
 
-	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle);
+	handle = zram_get_handle(zram, index);
+	cmem = zs_map_object(zram->mem_pool, handle);
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    zram->table[index].size,
-				    uncmem, &clen);
+	ret = zcomp_decompress(zram->comp, cmem + sizeof(*zheader),
+			       zram->table[index].size, uncmem);
 
-	if (is_partial_io(bvec)) {
+	if (is_partial_io(bvec))
 		memcpy(user_mem + bvec->bv_offset, uncmem + offset,
 		       bvec->bv_len);
-		kfree(uncmem);
-	}
 
-	zs_unmap_object(zram->mem_pool, zram->table[index].handle);
+	zs_unmap_object(zram->mem_pool, handle);
 	kunmap_atomic(user_mem);
 
+	if (likely(!ret))
+		flush_dcache_page(page);
+
+out:
+	read_unlock(&zram->tb_lock);
+	if (is_partial_io(bvec))
+		kfree(uncmem);
+
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
 		zram_stat64_inc(zram, &zram->stats.failed_reads);
-		return ret;
 	}
 
-	flush_dcache_page(page);
-
-	return 0;
+	return ret;
 }
 
 static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
 {
-	int ret;
-	size_t clen = PAGE_SIZE;
+	int ret = 0;
+	void *handle;
 	struct zobj_header *zheader;
 	unsigned char *cmem;
 
+	read_lock(&zram->tb_lock);
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		unsigned long blk_idx = zram->table[index].element;
+		struct page *page;
+
+		read_unlock(&zram->tb_lock);
+
+		page = alloc_page(GFP_NOIO);
+		if (!page)
+			return -ENOMEM;
+		ret = zram_read_from_bdev(zram, page, blk_idx);
+		if (!ret) {
+			cmem = kmap_atomic(page);
+			memcpy(mem, cmem, PAGE_SIZE);
+			kunmap_atomic(cmem);
+		}
+		__free_page(page);
+		goto out_unlocked;
+	}
+
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_fill_page(mem, PAGE_SIZE, zram->table[index].element);
+		goto out;
+	}
+
 	if (zram_test_flag(zram, index, ZRAM_ZERO) ||
 	    !zram->table[index].handle) {
 		memset(mem, 0, PAGE_SIZE);
-		return 0;
+		goto out;
 	}
 
-	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle);
-
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		cmem = kmap_atomic(zram->table[index].handle);
 		memcpy(mem, cmem, PAGE_SIZE);
 		kunmap_atomic(cmem);
-		return 0;
+		goto out;
 	}
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    zram->table[index].size,
-				    mem, &clen);
-	zs_unmap_object(zram->mem_pool, zram->table[index].handle);
+	handle = zram_get_handle(zram, index);
+	cmem = zs_map_object(zram->mem_pool, handle);
+	ret = zcomp_decompress(zram->comp, cmem + sizeof(*zheader),
+			       zram->table[index].size, mem);
+	zs_unmap_object(zram->mem_pool, handle);
+
+out:
+	read_unlock(&zram->tb_lock);
+out_unlocked:
 
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
 		zram_stat64_inc(zram, &zram->stats.failed_reads);
-		return ret;
 	}
 
-	return 0;
+	return ret;
+}
+
+/*
+ * Account @extra_pages more pages of memory and check them against
+ * mem_limit. Returns false if the limit would be exceeded.
+ */
+static bool zram_mem_charge(struct zram *zram, unsigned long extra_pages)
+{
+	unsigned long used, old_max;
+
+	used = zs_get_total_pages(zram->mem_pool) +
+		zram->stats.pages_expand + extra_pages;
+	if (zram->limit_pages && used > zram->limit_pages)
+		return false;
+
+	old_max = atomic_long_read(&zram->stats.max_used_pages);
+	while (used > old_max) {
+		unsigned long cur;
+
+		cur = atomic_long_cmpxchg(&zram->stats.max_used_pages,
+					old_max, used);
+		if (cur == old_max)
+			break;
+		old_max = cur;
+	}
+
+	return true;
 }
 
 static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			   int offset)
 {
 	int ret;
-	u32 store_offset;
+	u32 checksum = 0;
 	size_t clen;
+	unsigned long element;
 	void *handle;
 	struct zobj_header *zheader;
-	struct page *page, *page_store;
+	struct zram_entry *entry = NULL;
+	struct page *page, *page_store = NULL;
+	struct zcomp_strm *zstrm = NULL;
 	unsigned char *user_mem, *cmem, *src, *uncmem = NULL;
 
 	page = bvec->bv_page;
-	src = zram->compress_buffer;
 
 	if (is_partial_io(bvec)) {
 		/*
@@ -337,19 +739,15 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			goto out;
 		}
 		ret = zram_read_before_write(zram, uncmem, index);
-		if (ret) {
-			kfree(uncmem);
+		if (ret)
 			goto out;
-		}
 	}
 
 	/*
-	 * System overwrites unused sectors. Free memory associated
-	 * with this sector now.
+	 * Grab a compression stream before mapping the page: this may
+	 * sleep until another writer releases one.
 	 */
-	if (zram->table[index].handle ||
-	    zram_test_flag(zram, index, ZRAM_ZERO))
-		zram_free_page(zram, index);
+	zstrm = zcomp_strm_find(zram->comp);
 
 	user_mem = kmap_atomic(page);
 
@@ -359,24 +757,31 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 	else
 		uncmem = user_mem;
 
-	if (page_zero_filled(uncmem)) {
+	if (page_same_filled(uncmem, &element)) {
 		kunmap_atomic(user_mem);
-		if (is_partial_io(bvec))
-			kfree(uncmem);
-		zram_stat_inc(&zram->stats.pages_zero);
-		zram_set_flag(zram, index, ZRAM_ZERO);
+
+		write_lock(&zram->tb_lock);
+		zram_free_page(zram, index);
+		if (!element) {
+			zram_set_flag(zram, index, ZRAM_ZERO);
+			zram_stat_inc(&zram->stats.pages_zero);
+		} else {
+			zram_set_flag(zram, index, ZRAM_SAME);
+			zram->table[index].element = element;
+			zram_stat_inc(&zram->stats.pages_same);
+		}
+		write_unlock(&zram->tb_lock);
 		ret = 0;
 		goto out;
 	}
 
-	ret = lzo1x_1_compress(uncmem, PAGE_SIZE, src, &clen,
-			       zram->compress_workmem);
+	ret = zcomp_compress(zram->comp, zstrm, uncmem, &clen);
 
 	kunmap_atomic(user_mem);
-	if (is_partial_io(bvec))
-			kfree(uncmem);
+	if (!is_partial_io(bvec))
+		uncmem = NULL;
 
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Compression failed! err=%d\n", ret);
 		goto out;
 	}
@@ -388,6 +793,11 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 	 */
 	if (unlikely(clen > max_zpage_size)) {
 		clen = PAGE_SIZE;
+		if (!zram_mem_charge(zram, 1)) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
 		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 		if (unlikely(!page_store)) {
 			pr_info("Error allocating memory for "
@@ -396,13 +806,26 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			goto out;
 		}
 
-		store_offset = 0;
-		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_inc(&zram->stats.pages_expand);
 		handle = page_store;
-		src = kmap_atomic(page);
+		user_mem = kmap_atomic(page);
+		src = is_partial_io(bvec) ? uncmem : user_mem;
 		cmem = kmap_atomic(page_store);
-		goto memstore;
+		memcpy(cmem, src, clen);
+		kunmap_atomic(cmem);
+		kunmap_atomic(user_mem);
+		goto update;
+	}
+
+	if (zram->dedup_enable) {
+		checksum = zram_dedup_checksum(zstrm->buffer, clen);
+		entry = zram_dedup_find(zram, zstrm->buffer, clen, checksum);
+		if (entry) {
+			handle = entry;
+			zram_stat64_inc(zram, &zram->stats.dedup_hits);
+			zram_stat64_add(zram, &zram->stats.dup_data_size,
+					clen);
+			goto update;
+		}
 	}
 
 	handle = zs_malloc(zram->mem_pool, clen + sizeof(*zheader));
@@ -412,58 +835,171 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 		ret = -ENOMEM;
 		goto out;
 	}
+
+	if (!zram_mem_charge(zram, 0)) {
+		zs_free(zram->mem_pool, handle);
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	cmem = zs_map_object(zram->mem_pool, handle);
 
-memstore:
 #if 0
 	/* Back-reference needed for memory defragmentation */
-	if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
-	}
+	zheader = (struct zobj_header *)cmem;
+	zheader->table_idx = index;
+	cmem += sizeof(*zheader);
 #endif
 
-	memcpy(cmem, src, clen);
+	memcpy(cmem, zstrm->buffer, clen);
+	zs_unmap_object(zram->mem_pool, handle);
 
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		kunmap_atomic(cmem);
-		kunmap_atomic(src);
-	} else {
-		zs_unmap_object(zram->mem_pool, handle);
+	if (zram->dedup_enable) {
+		/* Without an entry the page is simply not shareable */
+		entry = zram_dedup_insert(zram, handle, clen, checksum);
+		if (entry)
+			handle = entry;
 	}
 
+update:
+	zcomp_strm_release(zram->comp, zstrm);
+	zstrm = NULL;
+
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	write_lock(&zram->tb_lock);
+	zram_free_page(zram, index);
+
 	zram->table[index].handle = handle;
 	zram->table[index].size = clen;
 
 	/* Update stats */
-	zram_stat64_add(zram, &zram->stats.compr_size, clen);
-	zram_stat_inc(&zram->stats.pages_stored);
-	if (clen <= PAGE_SIZE / 2)
+	if (entry)
+		zram_set_flag(zram, index, ZRAM_DEDUP);
+
+	if (page_store) {
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_inc(&zram->stats.pages_expand);
+	} else if (clen <= PAGE_SIZE / 2) {
 		zram_stat_inc(&zram->stats.good_compress);
+	}
+	zram_stat_inc(&zram->stats.pages_stored);
+	write_unlock(&zram->tb_lock);
 
-	return 0;
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
 
 out:
+	if (zstrm)
+		zcomp_strm_release(zram->comp, zstrm);
+	if (is_partial_io(bvec))
+		kfree(uncmem);
 	if (ret)
 		zram_stat64_inc(zram, &zram->stats.failed_writes);
 	return ret;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+static int zram_can_writeback(struct zram *zram, u32 index, int mode)
+{
+	if (!zram->table[index].handle ||
+	    zram_test_flag(zram, index, ZRAM_SAME) ||
+	    zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_UNDER_WB))
+		return 0;
+
+	if (mode == ZRAM_WB_HUGE)
+		return zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+
+	return zram_test_flag(zram, index, ZRAM_IDLE);
+}
+
+/*
+ * Must be called with init_lock held. Returns the number of pages
+ * written back, or a negative error if none could be.
+ */
+ssize_t zram_writeback(struct zram *zram, int mode)
+{
+	int ret = 0;
+	ssize_t count = 0;
+	size_t index;
+	unsigned long blk_idx;
+	struct page *page;
+
+	if (!zram->backing_dev)
+		return -ENODEV;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		write_lock(&zram->tb_lock);
+		if (!zram_can_writeback(zram, index, mode)) {
+			write_unlock(&zram->tb_lock);
+			continue;
+		}
+		/* A write or free of the slot meanwhile clears this flag */
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		write_unlock(&zram->tb_lock);
+
+		blk_idx = zram_alloc_bdev_block(zram);
+		if (!blk_idx) {
+			ret = -ENOSPC;
+			goto clear;
+		}
+
+		ret = zram_read_before_write(zram, page_address(page), index);
+		if (!ret)
+			ret = zram_bdev_rw_page(zram, page, blk_idx, WRITE);
+		if (ret) {
+			zram_free_bdev_block(zram, blk_idx);
+			goto clear;
+		}
+
+		write_lock(&zram->tb_lock);
+		if (!zram_test_flag(zram, index, ZRAM_UNDER_WB) ||
+		    (mode == ZRAM_WB_IDLE &&
+		     !zram_test_flag(zram, index, ZRAM_IDLE))) {
+			/* Slot was rewritten or accessed, drop the copy */
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			write_unlock(&zram->tb_lock);
+			zram_free_bdev_block(zram, blk_idx);
+			continue;
+		}
+
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram->table[index].element = blk_idx;
+		zram_stat_inc(&zram->stats.bd_count);
+		write_unlock(&zram->tb_lock);
+		count++;
+		continue;
+
+clear:
+		write_lock(&zram->tb_lock);
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		write_unlock(&zram->tb_lock);
+		if (ret == -ENOSPC)
+			break;
+	}
+
+	__free_page(page);
+
+	return count ? count : ret;
+}
+#endif
+
 static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 			int offset, struct bio *bio, int rw)
 {
 	int ret;
 
-	if (rw == READ) {
-		down_read(&zram->lock);
+	if (rw == READ)
 		ret = zram_bvec_read(zram, bvec, index, offset, bio);
-		up_read(&zram->lock);
-	} else {
-		down_write(&zram->lock);
+	else
 		ret = zram_bvec_write(zram, bvec, index, offset);
-		up_write(&zram->lock);
-	}
 
 	return ret;
 }
@@ -475,6 +1011,104 @@ static void update_position(u32 *index, int *offset, struct bio_vec *bvec)
 	*offset = (*offset + bvec->bv_len) % PAGE_SIZE;
 }
 
+/* Per-bio state of a write that is spread across CPUs */
+struct zram_write_ctl {
+	struct zram *zram;
+	atomic_t pending;	/* pages not written yet */
+	int error;
+	struct completion done;
+};
+
+struct zram_write_work {
+	struct work_struct work;
+	struct zram_write_ctl *ctl;
+	struct bio_vec bvec;
+	u32 index;
+};
+
+static void zram_write_work_fn(struct work_struct *work)
+{
+	struct zram_write_work *zw =
+			container_of(work, struct zram_write_work, work);
+	struct zram_write_ctl *ctl = zw->ctl;
+
+	if (zram_bvec_write(ctl->zram, &zw->bvec, zw->index, 0) < 0)
+		ctl->error = 1;
+
+	if (atomic_dec_and_test(&ctl->pending))
+		complete(&ctl->done);
+}
+
+/*
+ * Only bios made of whole, page aligned pages are spread, so that each
+ * work item owns a distinct table entry.
+ */
+static int zram_can_write_parallel(struct zram *zram, struct bio *bio)
+{
+	int i;
+	struct bio_vec *bvec;
+
+	if (!zram->parallel_write_threshold ||
+	    bio->bi_size < zram->parallel_write_threshold ||
+	    bio_segments(bio) < 2)
+		return 0;
+
+	if (bio->bi_sector & (SECTORS_PER_PAGE - 1))
+		return 0;
+
+	bio_for_each_segment(bvec, bio, i) {
+		if (bvec->bv_len != PAGE_SIZE)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Compress the pages of a write bio on the device workqueue, and the
+ * last one on the submitting CPU, then wait until all of them are
+ * stored. Returns -ENOMEM if the work items could not be allocated,
+ * in which case the caller falls back to writing the pages itself.
+ */
+static int zram_write_parallel(struct zram *zram, struct bio *bio)
+{
+	int i, nr_pages;
+	u32 index;
+	struct bio_vec *bvec;
+	struct zram_write_ctl ctl;
+	struct zram_write_work *works, *zw;
+
+	nr_pages = bio_segments(bio);
+	works = kmalloc(nr_pages * sizeof(*works), GFP_NOIO | __GFP_NOWARN);
+	if (!works)
+		return -ENOMEM;
+
+	ctl.zram = zram;
+	ctl.error = 0;
+	atomic_set(&ctl.pending, nr_pages);
+	init_completion(&ctl.done);
+
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	zw = works;
+	bio_for_each_segment(bvec, bio, i) {
+		INIT_WORK(&zw->work, zram_write_work_fn);
+		zw->ctl = &ctl;
+		zw->bvec = *bvec;
+		zw->index = index++;
+		if (zw != works + nr_pages - 1)
+			queue_work(zram->write_wq, &zw->work);
+		zw++;
+	}
+
+	zram_write_work_fn(&works[nr_pages - 1].work);
+	wait_for_completion(&ctl.done);
+	kfree(works);
+
+	zram_stat64_inc(zram, &zram->stats.parallel_writes);
+
+	return ctl.error ? -EIO : 0;
+}
+
 static void __zram_make_request(struct zram *zram, struct bio *bio, int rw)
 {
 	int i, offset;
@@ -490,6 +1124,15 @@ static void __zram_make_request(struct zram *zram, struct bio *bio, int rw)
 		break;
 	}
 
+	if (rw == WRITE && zram_can_write_parallel(zram, bio)) {
+		int ret = zram_write_parallel(zram, bio);
+
+		if (ret == -EIO)
+			goto out;
+		if (!ret)
+			goto done;
+	}
+
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 	offset = (bio->bi_sector & (SECTORS_PER_PAGE - 1)) << SECTOR_SHIFT;
 
@@ -522,6 +1165,7 @@ static void __zram_make_request(struct zram *zram, struct bio *bio, int rw)
 		update_position(&index, &offset, bvec);
 	}
 
+done:
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
 	return;
@@ -577,31 +1221,76 @@ error:
 	bio_io_error(bio);
 }
 
+/*
+ * Must be called with init_lock held. Migrates objects out of sparsely
+ * used zspages and returns the number of pages freed.
+ */
+unsigned long zram_compact(struct zram *zram)
+{
+	unsigned long nr_freed;
+
+	nr_freed = zs_compact(zram->mem_pool);
+	zram->stats.pages_compacted_last = nr_freed;
+	zram_stat64_add(zram, &zram->stats.pages_compacted, nr_freed);
+
+	return nr_freed;
+}
+
+static int zram_shrink(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	int ret;
+	struct zram *zram = container_of(shrinker, struct zram, shrinker);
+
+	/* Don't wait for reset or init, nor for a reader to finish */
+	if (!down_read_trylock(&zram->init_lock))
+		return -1;
+
+	if (!zram->init_done) {
+		up_read(&zram->init_lock);
+		return 0;
+	}
+
+	if (sc->nr_to_scan)
+		zram_compact(zram);
+
+	ret = min_t(unsigned long, zs_pages_compactable(zram->mem_pool),
+			INT_MAX);
+	up_read(&zram->init_lock);
+
+	return ret;
+}
+
 void __zram_reset_device(struct zram *zram)
 {
 	size_t index;
 
+	if (zram->init_done)
+		unregister_shrinker(&zram->shrinker);
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Free the per-device compression backend */
+	if (zram->comp)
+		zcomp_destroy(zram->comp);
+	zram->comp = NULL;
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
 		void *handle = zram->table[index].handle;
-		if (!handle)
+		if (!handle || zram_test_flag(zram, index, ZRAM_SAME) ||
+		    zram_test_flag(zram, index, ZRAM_WB))
 			continue;
 
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
 			__free_page(handle);
+		else if (zram_test_flag(zram, index, ZRAM_DEDUP))
+			zram_dedup_put(zram, handle);
 		else
 			zs_free(zram->mem_pool, handle);
 	}
 
+	zram_dedup_fini(zram);
+	zram_reset_bdev(zram);
+
 	vfree(zram->table);
 	zram->table = NULL;
 
@@ -611,6 +1300,7 @@ void __zram_reset_device(struct zram *zram)
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
 
+	zram->limit_pages = 0;
 	zram->disksize = 0;
 }
 
@@ -635,20 +1325,15 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail_no_table;
-	}
-
-	zram->compress_buffer =
-		(void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	zram->comp = zcomp_create(zram->compressor, zram->max_comp_streams);
+	if (IS_ERR(zram->comp)) {
+		pr_err("Cannot initialise %s compressing backend\n",
+			zram->compressor);
+		ret = PTR_ERR(zram->comp);
+		zram->comp = NULL;
 		goto fail_no_table;
 	}
+	zcomp_set_acceleration(zram->comp, zram->comp_acceleration);
 
 	num_pages = zram->disksize >> PAGE_SHIFT;
 	zram->table = vzalloc(num_pages * sizeof(*zram->table));
@@ -663,13 +1348,24 @@ int zram_init_device(struct zram *zram)
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = zs_create_pool("zram", GFP_NOIO | __GFP_HIGHMEM);
+	zram->mem_pool = zs_create_pool(zram->disk->disk_name,
+					GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
 		goto fail;
 	}
 
+	if (zram->dedup_enable && zram_dedup_init(zram, num_pages)) {
+		pr_err("Error allocating zram dedup hash table\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	zram->shrinker.shrink = zram_shrink;
+	zram->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&zram->shrinker);
+
 	zram->init_done = 1;
 	up_write(&zram->init_lock);
 
@@ -692,7 +1388,9 @@ static void zram_slot_free_notify(struct block_device *bdev,
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	write_lock(&zram->tb_lock);
 	zram_free_page(zram, index);
+	write_unlock(&zram->tb_lock);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -705,9 +1403,16 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	init_rwsem(&zram->lock);
+	rwlock_init(&zram->tb_lock);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	spin_lock_init(&zram->bitmap_lock);
+#endif
 	init_rwsem(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	strlcpy(zram->compressor, default_compressor,
+		sizeof(zram->compressor));
+	zram->max_comp_streams = num_online_cpus();
+	zram->comp_acceleration = 1;
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -720,6 +1425,17 @@ static int create_device(struct zram *zram, int device_id)
 	blk_queue_make_request(zram->queue, zram_make_request);
 	zram->queue->queuedata = zram;
 
+	/* Compresses the pages of large write bios in parallel */
+	zram->write_wq = alloc_workqueue("zram%d", WQ_UNBOUND | WQ_MEM_RECLAIM,
+					0, device_id);
+	if (!zram->write_wq) {
+		blk_cleanup_queue(zram->queue);
+		pr_err("Error allocating workqueue for device %d\n",
+			device_id);
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	 /* gendisk structure */
 	zram->disk = alloc_disk(1);
 	if (!zram->disk) {
@@ -777,6 +1493,9 @@ static void destroy_device(struct zram *zram)
 
 	if (zram->queue)
 		blk_cleanup_queue(zram->queue);
+
+	if (zram->write_wq)
+		destroy_workqueue(zram->write_wq);
 }
 
 unsigned int zram_get_num_devices(void)
@@ -17,8 +17,11 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/shrinker.h>
 
 #include "../zsmalloc/zsmalloc.h"
+#include "zcomp.h"
+#include "zram_dedup.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -74,6 +77,21 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Handle points to a shared struct zram_entry */
+	ZRAM_DEDUP,
+
+	/* Page is filled with one repeated word, kept in table.element */
+	ZRAM_SAME,
+
+	/* Page lives on the backing device, block index in table.element */
+	ZRAM_WB,
+
+	/* Page is being written back to the backing device */
+	ZRAM_UNDER_WB,
+
+	/* Page has not been accessed since it was last marked idle */
+	ZRAM_IDLE,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
@@ -81,7 +99,11 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct table {
-	void *handle;
+	union {
+		void *handle;
+		unsigned long element;	/* ZRAM_SAME fill value or ZRAM_WB
+					 * backing device block index */
+	};
 	u16 size;	/* object size (excluding header) */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
@@ -95,20 +117,29 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
+	u64 dedup_hits;		/* no. of writes that shared a stored page */
+	u64 dup_data_size;	/* compressed bytes saved by sharing */
 	u32 pages_zero;		/* no. of zero filled pages */
+	u32 pages_same;		/* no. of other same element filled pages */
+	u32 bd_count;		/* no. of pages on the backing device */
+	u64 bd_reads;		/* no. of reads from the backing device */
+	u64 bd_writes;		/* no. of writes to the backing device */
+	u64 parallel_writes;	/* no. of bios compressed in parallel */
+	u64 pages_compacted;	/* no. of pages freed by compaction */
+	u32 pages_compacted_last; /* pages freed by the last compaction */
 	u32 pages_stored;	/* no. of pages currently stored */
+	atomic_long_t max_used_pages;	/* high watermark of memory used */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
 };
 
 struct zram {
 	struct zs_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zcomp *comp;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct rw_semaphore lock; /* protect compression buffers and table
-				   * against concurrent read and writes */
+	rwlock_t tb_lock;	/* protect table entries against concurrent
+				 * read, write and free */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -119,8 +150,34 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	/* Limit on memory used to store data, in pages. 0 means no limit */
+	unsigned long limit_pages;
 
 	struct zram_stats stats;
+	char compressor[10];
+	int max_comp_streams;
+	/* lz4 speed/ratio trade-off, 1 is regular compression */
+	int comp_acceleration;
+	/* Write bios of at least this many bytes are compressed in parallel */
+	unsigned int parallel_write_threshold;
+	struct workqueue_struct *write_wq;
+	/* Compacts the memory pool under memory pressure */
+	struct shrinker shrinker;
+
+	/* Share identical compressed pages (see zram_dedup.c) */
+	int dedup_enable;
+	spinlock_t dedup_lock;	/* protect dedup hash and refcounts */
+	struct hlist_head *dedup_hash;
+	size_t dedup_nr_buckets;
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	struct file *backing_dev;
+	struct block_device *bdev;
+	unsigned int old_block_size;
+	unsigned long *bitmap;	/* allocated backing device blocks */
+	unsigned long nr_pages;	/* size of the backing device */
+	spinlock_t bitmap_lock;
+#endif
 };
 
 extern struct zram *zram_devices;
@@ -131,5 +188,21 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void __zram_reset_device(struct zram *zram);
+extern unsigned long zram_compact(struct zram *zram);
+
+/* zram_writeback() modes */
+enum zram_wb_mode {
+	ZRAM_WB_IDLE,	/* pages not accessed since marked idle */
+	ZRAM_WB_HUGE,	/* pages stored uncompressed */
+};
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+extern int zram_set_backing_dev(struct zram *zram, const char *file_name);
+extern void zram_reset_bdev(struct zram *zram);
+extern void zram_mark_idle(struct zram *zram);
+extern ssize_t zram_writeback(struct zram *zram, int mode);
+#else
+static inline void zram_reset_bdev(struct zram *zram) {}
+#endif
 
 #endif
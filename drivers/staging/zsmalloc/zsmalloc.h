@@ -27,5 +27,9 @@ void *zs_map_object(struct zs_pool *pool, void *handle);
 void zs_unmap_object(struct zs_pool *pool, void *handle);
 
 u64 zs_get_total_size_bytes(struct zs_pool *pool);
+unsigned long zs_get_total_pages(struct zs_pool *pool);
+
+unsigned long zs_compact(struct zs_pool *pool);
+unsigned long zs_pages_compactable(struct zs_pool *pool);
 
 #endif
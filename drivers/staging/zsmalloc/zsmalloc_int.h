@@ -34,12 +34,16 @@
 
 /*
  * Object location (<PFN>, <obj_idx>) is encoded as
- * as single (void *) handle value.
+ * as single unsigned long value.
  *
  * Note that object index <obj_idx> is relative to system
  * page <PFN> it is stored in, so for each sub-page belonging
  * to a zspage, obj_idx starts with 0.
  *
+ * Users do not see that value: zs_malloc() returns a handle, which
+ * is a pointer to a separately allocated word holding the encoded
+ * location, so that objects can be moved around by compaction.
+ *
  * This is made more complicated by various memory models and PAE.
  */
 
@@ -54,8 +58,25 @@
 #define MAX_PHYSMEM_BITS BITS_PER_LONG
 #endif
 #endif
+
+/*
+ * The encoded location is shifted left by OBJ_TAG_BITS, leaving the
+ * least significant bit free:
+ *  - in the handle word, it serves as a lock (HANDLE_PIN_BIT) that
+ *    keeps the object from being migrated while it is mapped or freed
+ *  - the first word of every allocated object holds its handle with
+ *    OBJ_ALLOCATED_TAG set, which tells it apart from the freelist
+ *    link stored in free objects
+ */
+#define OBJ_TAG_BITS		1
+#define OBJ_ALLOCATED_TAG	1
+#define HANDLE_PIN_BIT		0
+
+/* Size of the handle back-reference at the start of each object */
+#define ZS_HANDLE_SIZE		(sizeof(unsigned long))
+
 #define _PFN_BITS		(MAX_PHYSMEM_BITS - PAGE_SHIFT)
-#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS)
+#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS - OBJ_TAG_BITS)
 #define OBJ_INDEX_MASK	((_AC(1, UL) << OBJ_INDEX_BITS) - 1)
 
 #define MAX(a, b) ((a) >= (b) ? (a) : (b))
@@ -130,6 +151,9 @@ struct size_class {
 
 	/* stats */
 	u64 pages_allocated;
+	unsigned long objs_inuse;
+	/* zspages on each fullness list */
+	unsigned long zspage_count[_ZS_NR_FULLNESS_GROUPS];
 
 	struct page *fullness_list[_ZS_NR_FULLNESS_GROUPS];
 };
@@ -141,8 +165,19 @@ struct size_class {
  * This must be power of 2 and less than or equal to ZS_ALIGN
  */
 struct link_free {
-	/* Handle of next free chunk (encodes <PFN, obj_idx>) */
-	void *next;
+	union {
+		/* Location of next free chunk (encodes <PFN, obj_idx>) */
+		unsigned long next;
+		/* Handle of allocated object, with OBJ_ALLOCATED_TAG */
+		unsigned long handle;
+	};
+};
+
+/* Operations whose latency is accounted with CONFIG_ZSMALLOC_STAT */
+enum zs_stat_op {
+	ZS_STAT_MALLOC,
+	ZS_STAT_MAP,
+	NR_ZS_STAT_OPS
 };
 
 struct zs_pool {
@@ -150,6 +185,13 @@ struct zs_pool {
 
 	gfp_t flags;	/* allocation flags used when growing pool */
 	const char *name;
+	atomic_long_t pages_allocated;	/* sum over all size classes */
+
+#ifdef CONFIG_ZSMALLOC_STAT
+	struct dentry *stat_dentry;
+	atomic64_t op_count[NR_ZS_STAT_OPS];
+	atomic64_t op_ns[NR_ZS_STAT_OPS];	/* cumulative time spent */
+#endif
 };
 
 #endif
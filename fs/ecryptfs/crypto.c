@@ -34,19 +34,12 @@
 #include <linux/file.h>
 #include <linux/scatterlist.h>
 #include <linux/slab.h>
+#include <linux/workqueue.h>
 #include <asm/unaligned.h>
 #include "ecryptfs_kernel.h"
 
-static int
-ecryptfs_decrypt_page_offset(struct ecryptfs_crypt_stat *crypt_stat,
-			     struct page *dst_page, int dst_offset,
-			     struct page *src_page, int src_offset, int size,
-			     unsigned char *iv);
-static int
-ecryptfs_encrypt_page_offset(struct ecryptfs_crypt_stat *crypt_stat,
-			     struct page *dst_page, int dst_offset,
-			     struct page *src_page, int src_offset, int size,
-			     unsigned char *iv);
+#define DECRYPT		0
+#define ENCRYPT		1
 
 /**
  * ecryptfs_to_hex
@@ -242,8 +235,10 @@ void ecryptfs_destroy_crypt_stat(struct ecryptfs_crypt_stat *crypt_stat)
 {
 	struct ecryptfs_key_sig *key_sig, *key_sig_tmp;
 
+	if (crypt_stat->req_pool)
+		mempool_destroy(crypt_stat->req_pool);
 	if (crypt_stat->tfm)
-		crypto_free_blkcipher(crypt_stat->tfm);
+		crypto_free_ablkcipher(crypt_stat->tfm);
 	if (crypt_stat->hash_tfm)
 		crypto_free_hash(crypt_stat->hash_tfm);
 	list_for_each_entry_safe(key_sig, key_sig_tmp,
@@ -323,25 +318,18 @@ int virt_to_scatterlist(const void *addr, int size, struct scatterlist *sg,
 }
 
 /**
- * encrypt_scatterlist
- * @crypt_stat: Pointer to the crypt_stat struct to initialize.
- * @dest_sg: Destination of encrypted data
- * @src_sg: Data to be encrypted
- * @size: Length of data to be encrypted
- * @iv: iv to use during encryption
+ * ecryptfs_set_key
+ * @crypt_stat: Cryptographic context
+ *
+ * Load the file encryption key into the tfm the first time it is used.
+ * The tfm itself is shared by all requests against the file; per
+ * operation state lives in the ablkcipher requests, so the mutex only
+ * covers this one-time setup.
  *
- * Returns the number of bytes encrypted; negative value on error
+ * Returns zero on success; negative value on error
  */
-static int encrypt_scatterlist(struct ecryptfs_crypt_stat *crypt_stat,
-			       struct scatterlist *dest_sg,
-			       struct scatterlist *src_sg, int size,
-			       unsigned char *iv)
+static int ecryptfs_set_key(struct ecryptfs_crypt_stat *crypt_stat)
 {
-	struct blkcipher_desc desc = {
-		.tfm = crypt_stat->tfm,
-		.info = iv,
-		.flags = CRYPTO_TFM_REQ_MAY_SLEEP
-	};
 	int rc = 0;
 
 	BUG_ON(!crypt_stat || !crypt_stat->tfm
@@ -352,84 +340,169 @@ static int encrypt_scatterlist(struct ecryptfs_crypt_stat *crypt_stat,
 		ecryptfs_dump_hex(crypt_stat->key,
 				  crypt_stat->key_size);
 	}
-	/* Consider doing this once, when the file is opened */
 	mutex_lock(&crypt_stat->cs_tfm_mutex);
 	if (!(crypt_stat->flags & ECRYPTFS_KEY_SET)) {
-		rc = crypto_blkcipher_setkey(crypt_stat->tfm, crypt_stat->key,
-					     crypt_stat->key_size);
-		crypt_stat->flags |= ECRYPTFS_KEY_SET;
-	}
-	if (rc) {
-		ecryptfs_printk(KERN_ERR, "Error setting key; rc = [%d]\n",
-				rc);
-		mutex_unlock(&crypt_stat->cs_tfm_mutex);
-		rc = -EINVAL;
-		goto out;
+		rc = crypto_ablkcipher_setkey(crypt_stat->tfm, crypt_stat->key,
+					      crypt_stat->key_size);
+		if (rc) {
+			ecryptfs_printk(KERN_ERR, "Error setting key; "
+					"rc = [%d]\n", rc);
+			rc = -EINVAL;
+		} else {
+			crypt_stat->flags |= ECRYPTFS_KEY_SET;
+		}
 	}
-	ecryptfs_printk(KERN_DEBUG, "Encrypting [%d] bytes.\n", size);
-	crypto_blkcipher_encrypt_iv(&desc, dest_sg, src_sg, size);
 	mutex_unlock(&crypt_stat->cs_tfm_mutex);
-out:
 	return rc;
 }
 
+/*
+ * Completion state shared by all of the extent requests issued for one
+ * page. @pending starts with a bias of one held by the submitter.
+ */
+struct extent_crypt_result {
+	struct completion completion;
+	atomic_t pending;
+	int rc;
+};
+
+struct extent_crypt_req {
+	struct extent_crypt_result *ecr;
+	struct scatterlist src_sg;
+	struct scatterlist dst_sg;
+	char iv[ECRYPTFS_MAX_IV_BYTES];
+	struct ablkcipher_request req;	/* must be last */
+};
+
+static void extent_crypt_done(struct extent_crypt_req *ecreq, int rc)
+{
+	struct extent_crypt_result *ecr = ecreq->ecr;
+
+	if (rc)
+		ecr->rc = rc;
+	if (atomic_dec_and_test(&ecr->pending))
+		complete(&ecr->completion);
+}
+
+/* Space taken by one extent request, including the cipher driver context */
+static size_t extent_crypt_req_size(struct crypto_ablkcipher *tfm)
+{
+	return ALIGN(sizeof(struct extent_crypt_req) +
+		     crypto_ablkcipher_reqsize(tfm), CRYPTO_MINALIGN);
+}
+
+/* crypt_stat->req_pool elements hold the requests for a whole page */
+#define ECRYPTFS_EXTENTS_PER_PAGE \
+	(PAGE_CACHE_SIZE / ECRYPTFS_DEFAULT_EXTENT_SIZE)
+
+static void extent_crypt_complete(struct crypto_async_request *req, int rc)
+{
+	/* A backlogged request has been moved to the queue */
+	if (rc == -EINPROGRESS)
+		return;
+	extent_crypt_done(req->data, rc);
+}
+
 /**
- * ecryptfs_lower_offset_for_extent
+ * ecryptfs_lower_offset_for_page
  *
  * Convert an eCryptfs page index into a lower byte offset
  */
-static void ecryptfs_lower_offset_for_extent(loff_t *offset, loff_t extent_num,
-					     struct ecryptfs_crypt_stat *crypt_stat)
+static loff_t ecryptfs_lower_offset_for_page(
+	struct ecryptfs_crypt_stat *crypt_stat, struct page *page)
 {
-	(*offset) = ecryptfs_lower_header_size(crypt_stat)
-		    + (crypt_stat->extent_size * extent_num);
+	return ecryptfs_lower_header_size(crypt_stat)
+	       + ((loff_t)page->index << PAGE_CACHE_SHIFT);
 }
 
 /**
- * ecryptfs_encrypt_extent
- * @enc_extent_page: Allocated page into which to encrypt the data in
- *                   @page
- * @crypt_stat: crypt_stat containing cryptographic context for the
- *              encryption operation
- * @page: Page containing plaintext data extent to encrypt
- * @extent_offset: Page extent offset for use in generating IV
+ * crypt_page_extents
+ * @crypt_stat: Cryptographic context
+ * @dst_page: The page to write the result into
+ * @src_page: The page to read from; may be the same as @dst_page
+ * @index: Upper page index, used to derive the extent IVs
+ * @op: ENCRYPT or DECRYPT
  *
- * Encrypts one extent of data.
+ * Every extent has its own IV, so each one is a separate CBC request.
+ * All of the requests for the page are issued before waiting for any
+ * of them, which lets an asynchronous cipher driver work on them in
+ * parallel. The requests come from crypt_stat->req_pool, so this cannot
+ * fail for lack of memory on the writepage path.
  *
- * Return zero on success; non-zero otherwise
+ * Returns zero on success; negative value on error
  */
-static int ecryptfs_encrypt_extent(struct page *enc_extent_page,
-				   struct ecryptfs_crypt_stat *crypt_stat,
-				   struct page *page,
-				   unsigned long extent_offset)
+static int crypt_page_extents(struct ecryptfs_crypt_stat *crypt_stat,
+			      struct page *dst_page, struct page *src_page,
+			      pgoff_t index, int op)
 {
-	loff_t extent_base;
-	char extent_iv[ECRYPTFS_MAX_IV_BYTES];
+	size_t extent_size = crypt_stat->extent_size;
+	unsigned long extents_per_page = PAGE_CACHE_SIZE / extent_size;
+	loff_t extent_base = (loff_t)index * extents_per_page;
+	size_t req_size = extent_crypt_req_size(crypt_stat->tfm);
+	struct extent_crypt_result ecr;
+	unsigned long extent_offset;
+	char *reqs;
 	int rc;
 
-	extent_base = (((loff_t)page->index)
-		       * (PAGE_CACHE_SIZE / crypt_stat->extent_size));
-	rc = ecryptfs_derive_iv(extent_iv, crypt_stat,
-				(extent_base + extent_offset));
-	if (rc) {
-		ecryptfs_printk(KERN_ERR, "Error attempting to derive IV for "
-			"extent [0x%.16llx]; rc = [%d]\n",
-			(unsigned long long)(extent_base + extent_offset), rc);
-		goto out;
-	}
-	rc = ecryptfs_encrypt_page_offset(crypt_stat, enc_extent_page, 0,
-					  page, (extent_offset
-						 * crypt_stat->extent_size),
-					  crypt_stat->extent_size, extent_iv);
-	if (rc < 0) {
-		printk(KERN_ERR "%s: Error attempting to encrypt page with "
-		       "page->index = [%ld], extent_offset = [%ld]; "
-		       "rc = [%d]\n", __func__, page->index, extent_offset,
-		       rc);
-		goto out;
-	}
-	rc = 0;
-out:
+	if (WARN_ON(extents_per_page > ECRYPTFS_EXTENTS_PER_PAGE))
+		return -EINVAL;
+	rc = ecryptfs_set_key(crypt_stat);
+	if (rc)
+		return rc;
+	reqs = mempool_alloc(crypt_stat->req_pool, GFP_NOFS);
+
+	init_completion(&ecr.completion);
+	atomic_set(&ecr.pending, 1);
+	ecr.rc = 0;
+
+	for (extent_offset = 0; extent_offset < extents_per_page;
+	     extent_offset++) {
+		struct extent_crypt_req *ecreq = (struct extent_crypt_req *)
+			(reqs + extent_offset * req_size);
+		int req_rc;
+
+		rc = ecryptfs_derive_iv(ecreq->iv, crypt_stat,
+					extent_base + extent_offset);
+		if (rc) {
+			ecryptfs_printk(KERN_ERR, "Error attempting to derive "
+					"IV for extent [0x%.16llx]; "
+					"rc = [%d]\n", (unsigned long long)
+					(extent_base + extent_offset), rc);
+			break;
+		}
+		sg_init_table(&ecreq->src_sg, 1);
+		sg_set_page(&ecreq->src_sg, src_page, extent_size,
+			    extent_offset * extent_size);
+		sg_init_table(&ecreq->dst_sg, 1);
+		sg_set_page(&ecreq->dst_sg, dst_page, extent_size,
+			    extent_offset * extent_size);
+		ecreq->ecr = &ecr;
+		ablkcipher_request_set_tfm(&ecreq->req, crypt_stat->tfm);
+		ablkcipher_request_set_callback(&ecreq->req,
+				CRYPTO_TFM_REQ_MAY_BACKLOG |
+				CRYPTO_TFM_REQ_MAY_SLEEP,
+				extent_crypt_complete, ecreq);
+		ablkcipher_request_set_crypt(&ecreq->req, &ecreq->src_sg,
+					     &ecreq->dst_sg, extent_size,
+					     ecreq->iv);
+		atomic_inc(&ecr.pending);
+		req_rc = (op == ENCRYPT) ?
+			crypto_ablkcipher_encrypt(&ecreq->req) :
+			crypto_ablkcipher_decrypt(&ecreq->req);
+		if (req_rc != -EINPROGRESS && req_rc != -EBUSY)
+			extent_crypt_done(ecreq, req_rc);
+	}
+
+	/* Drop the submitter's bias and wait for the requests in flight */
+	if (!atomic_dec_and_test(&ecr.pending))
+		wait_for_completion(&ecr.completion);
+	mempool_free(reqs, crypt_stat->req_pool);
+	if (!rc)
+		rc = ecr.rc;
+	if (rc)
+		printk(KERN_ERR "%s: Error attempting to %s page with "
+		       "page->index = [%ld]; rc = [%d]\n", __func__,
+		       (op == ENCRYPT) ? "encrypt" : "decrypt", index, rc);
 	return rc;
 }
 
@@ -439,10 +512,11 @@ out:
  *        decrypted content that needs to be encrypted (to a temporary
  *        page; not in place) and written out to the lower file
  *
- * Encrypt an eCryptfs page. This is done on a per-extent basis. Note
- * that eCryptfs pages may straddle the lower pages -- for instance,
- * if the file was created on a machine with an 8K page size
- * (resulting in an 8K header), and then the file is copied onto a
+ * Encrypt an eCryptfs page. The extents of the page are encrypted into
+ * a temporary page, which is then written to the lower file with a
+ * single call. Note that eCryptfs pages may straddle the lower pages --
+ * for instance, if the file was created on a machine with an 8K page
+ * size (resulting in an 8K header), and then the file is copied onto a
  * host with a 32K page size, then when reading page 0 of the eCryptfs
  * file, 24K of page 0 of the lower file will be read and decrypted,
  * and then 8K of page 1 of the lower file will be read and decrypted.
@@ -455,7 +529,6 @@ int ecryptfs_encrypt_page(struct page *page)
 	struct ecryptfs_crypt_stat *crypt_stat;
 	char *enc_extent_virt;
 	struct page *enc_extent_page = NULL;
-	loff_t extent_offset;
 	int rc = 0;
 
 	ecryptfs_inode = page->mapping->host;
@@ -469,75 +542,26 @@ int ecryptfs_encrypt_page(struct page *page)
 				"encrypted extent\n");
 		goto out;
 	}
-	enc_extent_virt = kmap(enc_extent_page);
-	for (extent_offset = 0;
-	     extent_offset < (PAGE_CACHE_SIZE / crypt_stat->extent_size);
-	     extent_offset++) {
-		loff_t offset;
-
-		rc = ecryptfs_encrypt_extent(enc_extent_page, crypt_stat, page,
-					     extent_offset);
-		if (rc) {
-			printk(KERN_ERR "%s: Error encrypting extent; "
-			       "rc = [%d]\n", __func__, rc);
-			goto out;
-		}
-		ecryptfs_lower_offset_for_extent(
-			&offset, ((((loff_t)page->index)
-				   * (PAGE_CACHE_SIZE
-				      / crypt_stat->extent_size))
-				  + extent_offset), crypt_stat);
-		rc = ecryptfs_write_lower(ecryptfs_inode, enc_extent_virt,
-					  offset, crypt_stat->extent_size);
-		if (rc < 0) {
-			ecryptfs_printk(KERN_ERR, "Error attempting "
-					"to write lower page; rc = [%d]"
-					"\n", rc);
-			goto out;
-		}
-	}
-	rc = 0;
-out:
-	if (enc_extent_page) {
-		kunmap(enc_extent_page);
-		__free_page(enc_extent_page);
-	}
-	return rc;
-}
-
-static int ecryptfs_decrypt_extent(struct page *page,
-				   struct ecryptfs_crypt_stat *crypt_stat,
-				   struct page *enc_extent_page,
-				   unsigned long extent_offset)
-{
-	loff_t extent_base;
-	char extent_iv[ECRYPTFS_MAX_IV_BYTES];
-	int rc;
-
-	extent_base = (((loff_t)page->index)
-		       * (PAGE_CACHE_SIZE / crypt_stat->extent_size));
-	rc = ecryptfs_derive_iv(extent_iv, crypt_stat,
-				(extent_base + extent_offset));
-	if (rc) {
-		ecryptfs_printk(KERN_ERR, "Error attempting to derive IV for "
-			"extent [0x%.16llx]; rc = [%d]\n",
-			(unsigned long long)(extent_base + extent_offset), rc);
+	rc = crypt_page_extents(crypt_stat, enc_extent_page, page,
+				page->index, ENCRYPT);
+	if (rc)
 		goto out;
-	}
-	rc = ecryptfs_decrypt_page_offset(crypt_stat, page,
-					  (extent_offset
-					   * crypt_stat->extent_size),
-					  enc_extent_page, 0,
-					  crypt_stat->extent_size, extent_iv);
+	enc_extent_virt = kmap(enc_extent_page);
+	rc = ecryptfs_write_lower(ecryptfs_inode, enc_extent_virt,
+				  ecryptfs_lower_offset_for_page(crypt_stat,
+								 page),
+				  PAGE_CACHE_SIZE);
+	kunmap(enc_extent_page);
 	if (rc < 0) {
-		printk(KERN_ERR "%s: Error attempting to decrypt to page with "
-		       "page->index = [%ld], extent_offset = [%ld]; "
-		       "rc = [%d]\n", __func__, page->index, extent_offset,
-		       rc);
+		ecryptfs_printk(KERN_ERR, "Error attempting "
+				"to write lower page; rc = [%d]"
+				"\n", rc);
 		goto out;
 	}
 	rc = 0;
 out:
+	if (enc_extent_page)
+		__free_page(enc_extent_page);
 	return rc;
 }
 
@@ -547,7 +571,8 @@ out:
  *        and decrypted from the lower file will be written into this
  *        page
  *
- * Decrypt an eCryptfs page. This is done on a per-extent basis. Note
+ * Decrypt an eCryptfs page. The whole page is read from the lower file
+ * with a single call and its extents are then decrypted in place. Note
  * that eCryptfs pages may straddle the lower pages -- for instance,
  * if the file was created on a machine with an 8K page size
  * (resulting in an 8K header), and then the file is copied onto a
@@ -561,160 +586,31 @@ int ecryptfs_decrypt_page(struct page *page)
 {
 	struct inode *ecryptfs_inode;
 	struct ecryptfs_crypt_stat *crypt_stat;
-	char *enc_extent_virt;
-	struct page *enc_extent_page = NULL;
-	unsigned long extent_offset;
-	int rc = 0;
+	char *page_virt;
+	int rc;
 
 	ecryptfs_inode = page->mapping->host;
 	crypt_stat =
 		&(ecryptfs_inode_to_private(ecryptfs_inode)->crypt_stat);
 	BUG_ON(!(crypt_stat->flags & ECRYPTFS_ENCRYPTED));
-	enc_extent_page = alloc_page(GFP_USER);
-	if (!enc_extent_page) {
-		rc = -ENOMEM;
-		ecryptfs_printk(KERN_ERR, "Error allocating memory for "
-				"encrypted extent\n");
-		goto out;
-	}
-	enc_extent_virt = kmap(enc_extent_page);
-	for (extent_offset = 0;
-	     extent_offset < (PAGE_CACHE_SIZE / crypt_stat->extent_size);
-	     extent_offset++) {
-		loff_t offset;
-
-		ecryptfs_lower_offset_for_extent(
-			&offset, ((page->index * (PAGE_CACHE_SIZE
-						  / crypt_stat->extent_size))
-				  + extent_offset), crypt_stat);
-		rc = ecryptfs_read_lower(enc_extent_virt, offset,
-					 crypt_stat->extent_size,
-					 ecryptfs_inode);
-		if (rc < 0) {
-			ecryptfs_printk(KERN_ERR, "Error attempting "
-					"to read lower page; rc = [%d]"
-					"\n", rc);
-			goto out;
-		}
-		rc = ecryptfs_decrypt_extent(page, crypt_stat, enc_extent_page,
-					     extent_offset);
-		if (rc) {
-			printk(KERN_ERR "%s: Error encrypting extent; "
-			       "rc = [%d]\n", __func__, rc);
-			goto out;
-		}
-	}
-out:
-	if (enc_extent_page) {
-		kunmap(enc_extent_page);
-		__free_page(enc_extent_page);
-	}
-	return rc;
-}
-
-/**
- * decrypt_scatterlist
- * @crypt_stat: Cryptographic context
- * @dest_sg: The destination scatterlist to decrypt into
- * @src_sg: The source scatterlist to decrypt from
- * @size: The number of bytes to decrypt
- * @iv: The initialization vector to use for the decryption
- *
- * Returns the number of bytes decrypted; negative value on error
- */
-static int decrypt_scatterlist(struct ecryptfs_crypt_stat *crypt_stat,
-			       struct scatterlist *dest_sg,
-			       struct scatterlist *src_sg, int size,
-			       unsigned char *iv)
-{
-	struct blkcipher_desc desc = {
-		.tfm = crypt_stat->tfm,
-		.info = iv,
-		.flags = CRYPTO_TFM_REQ_MAY_SLEEP
-	};
-	int rc = 0;
-
-	/* Consider doing this once, when the file is opened */
-	mutex_lock(&crypt_stat->cs_tfm_mutex);
-	rc = crypto_blkcipher_setkey(crypt_stat->tfm, crypt_stat->key,
-				     crypt_stat->key_size);
-	if (rc) {
-		ecryptfs_printk(KERN_ERR, "Error setting key; rc = [%d]\n",
-				rc);
-		mutex_unlock(&crypt_stat->cs_tfm_mutex);
-		rc = -EINVAL;
-		goto out;
-	}
-	ecryptfs_printk(KERN_DEBUG, "Decrypting [%d] bytes.\n", size);
-	rc = crypto_blkcipher_decrypt_iv(&desc, dest_sg, src_sg, size);
-	mutex_unlock(&crypt_stat->cs_tfm_mutex);
-	if (rc) {
-		ecryptfs_printk(KERN_ERR, "Error decrypting; rc = [%d]\n",
-				rc);
+	page_virt = kmap(page);
+	rc = ecryptfs_read_lower(page_virt,
+				 ecryptfs_lower_offset_for_page(crypt_stat,
+								page),
+				 PAGE_CACHE_SIZE, ecryptfs_inode);
+	kunmap(page);
+	if (rc < 0) {
+		ecryptfs_printk(KERN_ERR, "Error attempting "
+				"to read lower page; rc = [%d]"
+				"\n", rc);
 		goto out;
 	}
-	rc = size;
+	rc = crypt_page_extents(crypt_stat, page, page, page->index,
+				DECRYPT);
 out:
 	return rc;
 }
 
-/**
- * ecryptfs_encrypt_page_offset
- * @crypt_stat: The cryptographic context
- * @dst_page: The page to encrypt into
- * @dst_offset: The offset in the page to encrypt into
- * @src_page: The page to encrypt from
- * @src_offset: The offset in the page to encrypt from
- * @size: The number of bytes to encrypt
- * @iv: The initialization vector to use for the encryption
- *
- * Returns the number of bytes encrypted
- */
-static int
-ecryptfs_encrypt_page_offset(struct ecryptfs_crypt_stat *crypt_stat,
-			     struct page *dst_page, int dst_offset,
-			     struct page *src_page, int src_offset, int size,
-			     unsigned char *iv)
-{
-	struct scatterlist src_sg, dst_sg;
-
-	sg_init_table(&src_sg, 1);
-	sg_init_table(&dst_sg, 1);
-
-	sg_set_page(&src_sg, src_page, size, src_offset);
-	sg_set_page(&dst_sg, dst_page, size, dst_offset);
-	return encrypt_scatterlist(crypt_stat, &dst_sg, &src_sg, size, iv);
-}
-
-/**
- * ecryptfs_decrypt_page_offset
- * @crypt_stat: The cryptographic context
- * @dst_page: The page to decrypt into
- * @dst_offset: The offset in the page to decrypt into
- * @src_page: The page to decrypt from
- * @src_offset: The offset in the page to decrypt from
- * @size: The number of bytes to decrypt
- * @iv: The initialization vector to use for the decryption
- *
- * Returns the number of bytes decrypted
- */
-static int
-ecryptfs_decrypt_page_offset(struct ecryptfs_crypt_stat *crypt_stat,
-			     struct page *dst_page, int dst_offset,
-			     struct page *src_page, int src_offset, int size,
-			     unsigned char *iv)
-{
-	struct scatterlist src_sg, dst_sg;
-
-	sg_init_table(&src_sg, 1);
-	sg_set_page(&src_sg, src_page, size, src_offset);
-
-	sg_init_table(&dst_sg, 1);
-	sg_set_page(&dst_sg, dst_page, size, dst_offset);
-
-	return decrypt_scatterlist(crypt_stat, &dst_sg, &src_sg, size, iv);
-}
-
 #define ECRYPTFS_MAX_SCATTERLIST_LEN 4
 
 /**
@@ -728,6 +624,7 @@ ecryptfs_decrypt_page_offset(struct ecryptfs_crypt_stat *crypt_stat,
  */
 int ecryptfs_init_crypt_ctx(struct ecryptfs_crypt_stat *crypt_stat)
 {
+	struct crypto_ablkcipher *tfm;
 	char *full_alg_name;
 	int rc = -EINVAL;
 
@@ -749,18 +646,25 @@ int ecryptfs_init_crypt_ctx(struct ecryptfs_crypt_stat *crypt_stat)
 						    crypt_stat->cipher, "cbc");
 	if (rc)
 		goto out_unlock;
-	crypt_stat->tfm = crypto_alloc_blkcipher(full_alg_name, 0,
-						 CRYPTO_ALG_ASYNC);
+	tfm = crypto_alloc_ablkcipher(full_alg_name, 0, 0);
 	kfree(full_alg_name);
-	if (IS_ERR(crypt_stat->tfm)) {
-		rc = PTR_ERR(crypt_stat->tfm);
-		crypt_stat->tfm = NULL;
+	if (IS_ERR(tfm)) {
+		rc = PTR_ERR(tfm);
 		ecryptfs_printk(KERN_ERR, "cryptfs: init_crypt_ctx(): "
 				"Error initializing cipher [%s]\n",
 				crypt_stat->cipher);
 		goto out_unlock;
 	}
-	crypto_blkcipher_set_flags(crypt_stat->tfm, CRYPTO_TFM_REQ_WEAK_KEY);
+	crypto_ablkcipher_set_flags(tfm, CRYPTO_TFM_REQ_WEAK_KEY);
+	/* Keeps writepage going under memory pressure */
+	crypt_stat->req_pool = mempool_create_kmalloc_pool(1,
+		ECRYPTFS_EXTENTS_PER_PAGE * extent_crypt_req_size(tfm));
+	if (!crypt_stat->req_pool) {
+		crypto_free_ablkcipher(tfm);
+		rc = -ENOMEM;
+		goto out_unlock;
+	}
+	crypt_stat->tfm = tfm;
 	rc = 0;
 out_unlock:
 	mutex_unlock(&crypt_stat->cs_tfm_mutex);
@@ -1767,11 +1671,15 @@ out:
 struct kmem_cache *ecryptfs_key_tfm_cache;
 static struct list_head key_tfm_list;
 struct mutex key_tfm_list_mutex;
+struct workqueue_struct *ecryptfs_read_wq;
 
 int __init ecryptfs_init_crypto(void)
 {
 	mutex_init(&key_tfm_list_mutex);
 	INIT_LIST_HEAD(&key_tfm_list);
+	ecryptfs_read_wq = alloc_workqueue("ecryptfs_read", WQ_UNBOUND, 0);
+	if (!ecryptfs_read_wq)
+		return -ENOMEM;
 	return 0;
 }
 
@@ -1793,6 +1701,10 @@ int ecryptfs_destroy_crypto(void)
 		kmem_cache_free(ecryptfs_key_tfm_cache, key_tfm);
 	}
 	mutex_unlock(&key_tfm_list_mutex);
+	if (ecryptfs_read_wq) {
+		destroy_workqueue(ecryptfs_read_wq);
+		ecryptfs_read_wq = NULL;
+	}
 	return 0;
 }
 
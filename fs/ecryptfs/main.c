@@ -591,6 +591,10 @@ out:
 static void ecryptfs_kill_block_super(struct super_block *sb)
 {
 	struct ecryptfs_sb_info *sb_info = ecryptfs_superblock_to_private(sb);
+
+	/* Readahead work holds inode references, let it finish first */
+	if (sb_info && atomic_read(&sb_info->read_work))
+		flush_workqueue(ecryptfs_read_wq);
 	kill_anon_super(sb);
 	if (!sb_info)
 		return;
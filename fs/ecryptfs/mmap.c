@@ -33,6 +33,7 @@
 #include <linux/crypto.h>
 #include <linux/scatterlist.h>
 #include <linux/slab.h>
+#include <linux/workqueue.h>
 #include <asm/unaligned.h>
 #include "ecryptfs_kernel.h"
 
@@ -255,6 +256,90 @@ out:
 	return rc;
 }
 
+struct ecryptfs_read_work {
+	struct work_struct work;
+	struct page *page;
+	struct inode *inode;
+};
+
+/*
+ * The work item holds a reference on the inode and on its lower file,
+ * taken in ecryptfs_readpages(), so that the lower file cannot be
+ * released by a last close while the work is still queued. It is also
+ * counted in the superblock, which ecryptfs_kill_block_super() drains.
+ * Nothing of the mount is touched once the count has been dropped.
+ */
+static void ecryptfs_read_work_fn(struct work_struct *work)
+{
+	struct ecryptfs_read_work *rw =
+		container_of(work, struct ecryptfs_read_work, work);
+	struct ecryptfs_sb_info *sbi =
+		ecryptfs_superblock_to_private(rw->inode->i_sb);
+
+	ecryptfs_readpage(NULL, rw->page);
+	page_cache_release(rw->page);
+	ecryptfs_put_lower_file(rw->inode);
+	iput(rw->inode);
+	atomic_dec(&sbi->read_work);
+	kfree(rw);
+}
+
+/**
+ * ecryptfs_readpages
+ * @file: An eCryptfs file
+ * @mapping: The eCryptfs inode mapping
+ * @pages: List of pages to read ahead
+ * @nr_pages: Number of pages on @pages
+ *
+ * Readahead for encrypted files hands each page to ecryptfs_read_wq so
+ * that the pages of a readahead window are decrypted on all CPUs rather
+ * than one after the other in the reader's context. Readers wait on the
+ * page lock as usual, which ecryptfs_readpage() drops once the page is
+ * done. Files that need no decryption are read in place.
+ *
+ * Returns zero
+ */
+static int ecryptfs_readpages(struct file *file, struct address_space *mapping,
+			      struct list_head *pages, unsigned nr_pages)
+{
+	struct ecryptfs_crypt_stat *crypt_stat =
+		&ecryptfs_inode_to_private(mapping->host)->crypt_stat;
+	bool async = file && (crypt_stat->flags & ECRYPTFS_ENCRYPTED)
+		     && !(crypt_stat->flags & ECRYPTFS_VIEW_AS_ENCRYPTED);
+	unsigned page_idx;
+
+	for (page_idx = 0; page_idx < nr_pages; page_idx++) {
+		struct page *page = list_entry(pages->prev, struct page, lru);
+		struct ecryptfs_read_work *rw;
+
+		list_del(&page->lru);
+		if (add_to_page_cache_lru(page, mapping, page->index,
+					  GFP_KERNEL))
+			goto next;
+		rw = async ? kmalloc(sizeof(*rw), GFP_KERNEL) : NULL;
+		if (rw && ecryptfs_get_lower_file(file->f_path.dentry,
+						  mapping->host)) {
+			kfree(rw);
+			rw = NULL;
+		}
+		if (!rw) {
+			ecryptfs_readpage(file, page);
+			goto next;
+		}
+		atomic_inc(&ecryptfs_superblock_to_private(
+				mapping->host->i_sb)->read_work);
+		ihold(mapping->host);
+		page_cache_get(page);
+		rw->page = page;
+		rw->inode = mapping->host;
+		INIT_WORK(&rw->work, ecryptfs_read_work_fn);
+		queue_work(ecryptfs_read_wq, &rw->work);
+next:
+		page_cache_release(page);
+	}
+	return 0;
+}
+
 /**
  * Called with lower inode mutex held.
  */
@@ -560,6 +645,7 @@ static sector_t ecryptfs_bmap(struct address_space *mapping, sector_t block)
 const struct address_space_operations ecryptfs_aops = {
 	.writepage = ecryptfs_writepage,
 	.readpage = ecryptfs_readpage,
+	.readpages = ecryptfs_readpages,
 	.write_begin = ecryptfs_write_begin,
 	.write_end = ecryptfs_write_end,
 	.bmap = ecryptfs_bmap,
@@ -0,0 +1,162 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * Copyright (c) 2013
+ * Phillip Lougher <phillip@squashfs.org.uk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * file_direct.c
+ */
+
+/*
+ * This file contains code for reading file datablocks directly into the
+ * page cache.  All the pages covered by the datablock are grabbed and the
+ * block is decompressed into them, avoiding the intermediate read_page
+ * cache and the copy out of it.  If any of the pages cannot be grabbed
+ * without blocking, or is already up to date, the datablock is read
+ * through the read_page cache instead.
+ */
+
+#include <linux/fs.h>
+#include <linux/vfs.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "page_actor.h"
+#include "squashfs_fs_i.h"
+#include "squashfs.h"
+
+/* Read the datablock through the read_page cache and copy it out */
+static int squashfs_read_cache(struct page *target_page, u64 block, int bsize)
+{
+	struct inode *inode = target_page->mapping->host;
+	struct squashfs_cache_entry *buffer = squashfs_get_datablock(inode->i_sb,
+		block, bsize);
+	int res = buffer->error;
+
+	if (res)
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+	else
+		squashfs_copy_cache(target_page, buffer, buffer->length, 0);
+
+	squashfs_cache_put(buffer);
+	return res;
+}
+
+
+/*
+ * Read and decompress the datablock containing target_page.  On success
+ * the target page is unlocked, on error it is left locked for the caller.
+ */
+int squashfs_readpage_block(struct page *target_page, u64 block, int bsize)
+{
+	struct inode *inode = target_page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int file_end = (i_size_read(inode) - 1) >> PAGE_CACHE_SHIFT;
+	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
+	int start_index = target_page->index & ~mask;
+	int end_index = start_index | mask;
+	int i, n, pages, bytes, missing_pages = 0, res = -ENOMEM;
+	struct page **page;
+	struct squashfs_page_actor actor;
+
+	if (end_index > file_end)
+		end_index = file_end;
+	pages = end_index - start_index + 1;
+
+	page = kmalloc(pages * sizeof(*page), GFP_KERNEL);
+	if (page == NULL)
+		goto fallback;
+
+	/*
+	 * Grab the pages covered by the datablock.  Missing or already up to
+	 * date pages would need a separate buffer to decompress into, so in
+	 * that case use the read_page cache.
+	 */
+	for (i = 0, n = start_index; i < pages; i++, n++) {
+		page[i] = (n == target_page->index) ? target_page :
+			grab_cache_page_nowait(target_page->mapping, n);
+
+		if (page[i] == NULL) {
+			missing_pages++;
+			continue;
+		}
+
+		if (page[i] != target_page && PageUptodate(page[i])) {
+			unlock_page(page[i]);
+			page_cache_release(page[i]);
+			page[i] = NULL;
+			missing_pages++;
+		}
+	}
+
+	if (missing_pages) {
+		for (i = 0; i < pages; i++) {
+			if (page[i] == NULL || page[i] == target_page)
+				continue;
+			unlock_page(page[i]);
+			page_cache_release(page[i]);
+		}
+		goto fallback;
+	}
+
+	/* The page actor maps one page at a time while decompressing */
+	squashfs_page_actor_init_special(&actor, page, pages, 0);
+	res = squashfs_read_data(inode->i_sb, block, bsize, NULL, &actor);
+	if (res > pages << PAGE_CACHE_SHIFT)
+		res = -EIO;
+
+	if (res >= 0) {
+		/* Zero the part of the pages not covered by the datablock */
+		i = res >> PAGE_CACHE_SHIFT;
+		bytes = res & (PAGE_CACHE_SIZE - 1);
+		if (bytes)
+			zero_user_segment(page[i++], bytes, PAGE_CACHE_SIZE);
+		for (; i < pages; i++)
+			zero_user_segment(page[i], 0, PAGE_CACHE_SIZE);
+	} else
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+
+	for (i = 0; i < pages; i++) {
+		if (res >= 0) {
+			flush_dcache_page(page[i]);
+			SetPageUptodate(page[i]);
+		}
+		if (page[i] != target_page) {
+			unlock_page(page[i]);
+			page_cache_release(page[i]);
+		}
+	}
+
+	if (res >= 0) {
+		unlock_page(target_page);
+		res = 0;
+	}
+
+	kfree(page);
+	return res;
+
+fallback:
+	kfree(page);
+	return squashfs_read_cache(target_page, block, bsize);
+}
@@ -67,6 +67,45 @@ static inline void oom_killer_enable(void)
 
 extern struct task_struct *find_lock_task_mm(struct task_struct *p);
 
+/*
+ * The Android lowmemorykiller keeps every thread group leader on
+ * init_task.tasks in a tree ordered by oom_score_adj, so that it can
+ * find its victim without walking the whole task list.
+ */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+static inline void lmk_adj_tree_init(struct task_struct *p)
+{
+	RB_CLEAR_NODE(&p->lmk_adj_node);
+}
+
+extern void lmk_adj_tree_add(struct task_struct *p);
+extern void lmk_adj_tree_del(struct task_struct *p);
+extern void lmk_adj_tree_replace(struct task_struct *old,
+				 struct task_struct *new);
+extern void lmk_adj_tree_update(struct task_struct *p);
+#else
+static inline void lmk_adj_tree_init(struct task_struct *p)
+{
+}
+
+static inline void lmk_adj_tree_add(struct task_struct *p)
+{
+}
+
+static inline void lmk_adj_tree_del(struct task_struct *p)
+{
+}
+
+static inline void lmk_adj_tree_replace(struct task_struct *old,
+					struct task_struct *new)
+{
+}
+
+static inline void lmk_adj_tree_update(struct task_struct *p)
+{
+}
+#endif
+
 /* sysctls */
 extern int sysctl_oom_dump_tasks;
 extern int sysctl_oom_kill_allocating_task;
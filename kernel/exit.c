@@ -70,6 +70,7 @@ static void __unhash_process(struct task_struct *p, bool group_dead)
 		detach_pid(p, PIDTYPE_SID);
 
 		list_del_rcu(&p->tasks);
+		lmk_adj_tree_del(p);
 		list_del_init(&p->sibling);
 		__this_cpu_dec(process_counts);
 	}
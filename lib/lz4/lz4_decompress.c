@@ -57,7 +57,7 @@ static int lz4_uncompress(const char *source, char *dest, int osize)
 	unsigned token;
 	size_t length;
 	size_t dec32table[] = {0, 3, 2, 3, 0, 0, 0, 0};
-#if LZ4_ARCH64
+#if LZ4_DEC_STEPSIZE == 8
 	size_t dec64table[] = {0, 0, 0, -1, 0, 1, 2, 3};
 #endif
 
@@ -89,7 +89,7 @@ static int lz4_uncompress(const char *source, char *dest, int osize)
 			ip += length;
 			break; /* EOF */
 		}
-		LZ4_WILDCOPY(ip, op, cpy);
+		LZ4_DEC_WILDCOPY(ip, op, cpy);
 		ip -= (op - cpy);
 		op = cpy;
 
@@ -110,8 +110,8 @@ static int lz4_uncompress(const char *source, char *dest, int osize)
 		}
 
 		/* copy repeated sequence */
-		if (unlikely((op - ref) < STEPSIZE)) {
-#if LZ4_ARCH64
+		if (unlikely((op - ref) < LZ4_DEC_STEPSIZE)) {
+#if LZ4_DEC_STEPSIZE == 8
 			size_t dec64 = dec64table[op - ref];
 #else
 			const int dec64 = 0;
@@ -124,18 +124,18 @@ static int lz4_uncompress(const char *source, char *dest, int osize)
 			ref += 4;
 			ref -= dec32table[op-ref];
 			PUT4(ref, op);
-			op += STEPSIZE - 4;
+			op += LZ4_DEC_STEPSIZE - 4;
 			ref -= dec64;
 		} else {
-			LZ4_COPYSTEP(ref, op);
+			LZ4_DEC_COPYSTEP(ref, op);
 		}
-		cpy = op + length - (STEPSIZE - 4);
+		cpy = op + length - (LZ4_DEC_STEPSIZE - 4);
 		if (cpy > (oend - COPYLENGTH)) {
 
 			/* Error: request to write beyond destination buffer */
 			if (cpy > oend)
 				goto _output_error;
-			LZ4_SECURECOPY(ref, op, (oend - COPYLENGTH));
+			LZ4_DEC_SECURECOPY(ref, op, (oend - COPYLENGTH));
 			while (op < cpy)
 				*op++ = *ref++;
 			op = cpy;
@@ -147,7 +147,7 @@ static int lz4_uncompress(const char *source, char *dest, int osize)
 				goto _output_error;
 			continue;
 		}
-		LZ4_SECURECOPY(ref, op, cpy);
+		LZ4_DEC_SECURECOPY(ref, op, cpy);
 		op = cpy; /* correction */
 	}
 	/* end of decoding */
@@ -171,7 +171,7 @@ static int lz4_uncompress_unknownoutputsize(const char *source, char *dest,
 	BYTE *cpy;
 
 	size_t dec32table[] = {0, 3, 2, 3, 0, 0, 0, 0};
-#if LZ4_ARCH64
+#if LZ4_DEC_STEPSIZE == 8
 	size_t dec64table[] = {0, 0, 0, -1, 0, 1, 2, 3};
 #endif
 
@@ -209,7 +209,7 @@ static int lz4_uncompress_unknownoutputsize(const char *source, char *dest,
 			op += length;
 			break;/* Necessarily EOF, due to parsing restrictions */
 		}
-		LZ4_WILDCOPY(ip, op, cpy);
+		LZ4_DEC_WILDCOPY(ip, op, cpy);
 		ip -= (op - cpy);
 		op = cpy;
 
@@ -236,8 +236,8 @@ static int lz4_uncompress_unknownoutputsize(const char *source, char *dest,
 		}
 
 		/* copy repeated sequence */
-		if (unlikely((op - ref) < STEPSIZE)) {
-#if LZ4_ARCH64
+		if (unlikely((op - ref) < LZ4_DEC_STEPSIZE)) {
+#if LZ4_DEC_STEPSIZE == 8
 			size_t dec64 = dec64table[op - ref];
 #else
 			const int dec64 = 0;
@@ -250,17 +250,17 @@ static int lz4_uncompress_unknownoutputsize(const char *source, char *dest,
 				ref += 4;
 				ref -= dec32table[op - ref];
 				PUT4(ref, op);
-				op += STEPSIZE - 4;
+				op += LZ4_DEC_STEPSIZE - 4;
 				ref -= dec64;
 		} else {
-			LZ4_COPYSTEP(ref, op);
+			LZ4_DEC_COPYSTEP(ref, op);
 		}
-		cpy = op + length - (STEPSIZE-4);
+		cpy = op + length - (LZ4_DEC_STEPSIZE-4);
 		if (cpy > oend - COPYLENGTH) {
 			if (cpy > oend)
 				goto _output_error; /* write outside of buf */
 
-			LZ4_SECURECOPY(ref, op, (oend - COPYLENGTH));
+			LZ4_DEC_SECURECOPY(ref, op, (oend - COPYLENGTH));
 			while (op < cpy)
 				*op++ = *ref++;
 			op = cpy;
@@ -272,7 +272,7 @@ static int lz4_uncompress_unknownoutputsize(const char *source, char *dest,
 				goto _output_error;
 			continue;
 		}
-		LZ4_SECURECOPY(ref, op, cpy);
+		LZ4_DEC_SECURECOPY(ref, op, cpy);
 		op = cpy; /* correction */
 	}
 	/* end of decoding */
@@ -154,3 +154,56 @@ typedef struct _U64_S { u64 v; } U64_S;
 		LZ4_WILDCOPY(s, d, e);	\
 		d = e;	\
 	} while (0)
+
+/*
+ * Decompressor copy primitives
+ *
+ * ARMv7 handles unaligned single word loads and stores in hardware
+ * (both the kernel and the boot decompressor run with SCTLR.A clear),
+ * but gcc may merge adjacent word accesses into ldrd/ldm, which still
+ * trap on unaligned addresses. There, copy 8 bytes per step with
+ * explicit ldr/str, issuing both loads before the stores. The match
+ * copy then has to spread offsets below 8 first, as on 64-bit.
+ */
+#if !LZ4_ARCH64 && defined(CONFIG_ARM) && __LINUX_ARM_ARCH__ >= 7 \
+	&& !defined(LZ4_GENERIC_COPY)
+#define LZ4_DEC_STEPSIZE 8
+
+static inline void lz4_copy8(u8 *d, const u8 *s)
+{
+	u32 a, b;
+
+	asm volatile(
+	"	ldr	%0, [%2]\n"
+	"	ldr	%1, [%2, #4]\n"
+	"	str	%0, [%3]\n"
+	"	str	%1, [%3, #4]\n"
+		: "=&r" (a), "=&r" (b)
+		: "r" (s), "r" (d)
+		: "memory");
+}
+
+#define LZ4_DEC_COPYSTEP(s, d)	\
+	do {			\
+		lz4_copy8(d, s);	\
+		d += 8;		\
+		s += 8;		\
+	} while (0)
+
+#define LZ4_DEC_WILDCOPY(s, d, e)	\
+	do {				\
+		LZ4_DEC_COPYSTEP(s, d);	\
+	} while (d < e)
+
+#define LZ4_DEC_SECURECOPY(s, d, e)		\
+	do {					\
+		if (d < e) {			\
+			LZ4_DEC_WILDCOPY(s, d, e);	\
+		}				\
+	} while (0)
+#else
+#define LZ4_DEC_STEPSIZE	STEPSIZE
+#define LZ4_DEC_COPYSTEP	LZ4_COPYSTEP
+#define LZ4_DEC_WILDCOPY	LZ4_WILDCOPY
+#define LZ4_DEC_SECURECOPY	LZ4_SECURECOPY
+#endif
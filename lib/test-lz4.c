@@ -0,0 +1,240 @@
+/*
+ * Runtime test and benchmark for the LZ4 decompressor
+ *
+ * Every test buffer is compressed with lz4_compress() and then restored
+ * both with the decompressor built for this architecture and with a copy
+ * of it built with the generic copy loops. The results are checked
+ * against the original data, then both decompressors are timed.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/ktime.h>
+#include <linux/lz4.h>
+
+/* Second copy of the decompressor, built with the generic copy loops */
+#define STATIC static
+#define LZ4_GENERIC_COPY
+#define lz4_decompress lz4_decompress_generic
+#define lz4_decompress_unknownoutputsize lz4_decompress_unknownoutputsize_generic
+#include "lz4/lz4_decompress.c"
+#undef lz4_decompress
+#undef lz4_decompress_unknownoutputsize
+#undef STATIC
+
+#define TEST_MAX_SIZE	(64 * 1024)
+
+static unsigned int bench_kb = 16 * 1024;
+module_param(bench_kb, uint, 0);
+MODULE_PARM_DESC(bench_kb, "KB of data to decompress per benchmark run");
+
+struct lz4_decompressor {
+	const char *name;
+	int (*decompress)(const char *src, size_t *src_len, char *dest,
+			size_t actual_dest_len);
+	int (*decompress_unknown)(const char *src, size_t src_len,
+			char *dest, size_t *dest_len);
+};
+
+static const struct lz4_decompressor decompressors[] = {
+	{ "arch", lz4_decompress, lz4_decompress_unknownoutputsize },
+	{ "generic", lz4_decompress_generic,
+		lz4_decompress_unknownoutputsize_generic },
+};
+
+static u32 test_seed;
+
+static u32 test_rand(void)
+{
+	test_seed = test_seed * 1103515245 + 12345;
+	return test_seed >> 8;
+}
+
+static void fill_zero(u8 *buf, size_t len)
+{
+	memset(buf, 0, len);
+}
+
+static void fill_text(u8 *buf, size_t len)
+{
+	static const char * const words[] = {
+		"the ", "page ", "cache ", "of ", "a ", "compressed ",
+		"block ", "device ", "memory ", "and ", "swap ", "to ",
+		"kernel ", "is ", "data ", "\n",
+	};
+	size_t i = 0;
+
+	while (i < len) {
+		const char *w = words[test_rand() % ARRAY_SIZE(words)];
+
+		while (*w && i < len)
+			buf[i++] = *w++;
+	}
+}
+
+/* Runs repeating with every period from 1 to 15 bytes */
+static void fill_periodic(u8 *buf, size_t len)
+{
+	size_t i, j, run;
+	unsigned int period = 1;
+
+	for (i = 0; i < len; i += run) {
+		run = min_t(size_t, 64 + test_rand() % 192, len - i);
+		for (j = 0; j < period && j < run; j++)
+			buf[i + j] = test_rand();
+		for (; j < run; j++)
+			buf[i + j] = buf[i + j - period];
+		period = period % 15 + 1;
+	}
+}
+
+static void fill_random(u8 *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = test_rand();
+}
+
+static const struct {
+	const char *name;
+	void (*fill)(u8 *buf, size_t len);
+} corpora[] = {
+	{ "zero", fill_zero },
+	{ "text", fill_text },
+	{ "periodic", fill_periodic },
+	{ "random", fill_random },
+};
+
+static const size_t test_sizes[] = { PAGE_SIZE, TEST_MAX_SIZE };
+
+struct lz4_test_bufs {
+	u8 *src;
+	u8 *dst;
+	u8 *cmp;
+	void *wrkmem;
+};
+
+static int __init test_lz4_check(struct lz4_test_bufs *b, const char *corpus,
+				size_t size, size_t clen)
+{
+	int i, ret;
+	size_t len;
+
+	for (i = 0; i < ARRAY_SIZE(decompressors); i++) {
+		const struct lz4_decompressor *d = &decompressors[i];
+
+		memset(b->dst, 0xa5, size);
+		len = 0;
+		ret = d->decompress((char *)b->cmp, &len, (char *)b->dst, size);
+		if (ret || len != clen || memcmp(b->src, b->dst, size)) {
+			pr_err("lz4 test: %s: %s %zu bytes: decompress failed\n",
+				d->name, corpus, size);
+			return -EINVAL;
+		}
+
+		memset(b->dst, 0xa5, size);
+		len = size;
+		ret = d->decompress_unknown((char *)b->cmp, clen,
+					(char *)b->dst, &len);
+		if (ret || len != size || memcmp(b->src, b->dst, size)) {
+			pr_err("lz4 test: %s: %s %zu bytes: "
+				"decompress_unknownoutputsize failed\n",
+				d->name, corpus, size);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+/* Returns the decompression speed in MB/s */
+static u64 __init test_lz4_bench(const struct lz4_decompressor *d,
+				struct lz4_test_bufs *b, size_t size)
+{
+	unsigned long i, iters;
+	size_t len;
+	ktime_t start;
+	s64 ns;
+
+	iters = max_t(unsigned long, ((unsigned long)bench_kb << 10) / size, 1);
+
+	start = ktime_get();
+	for (i = 0; i < iters; i++) {
+		d->decompress((char *)b->cmp, &len, (char *)b->dst, size);
+		if (!(i & 63))
+			cond_resched();
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (ns <= 0)
+		return 0;
+
+	return div64_u64((u64)iters * size * 1000, ns);
+}
+
+static int __init test_lz4_init(void)
+{
+	int i, j, ret = -ENOMEM;
+	size_t size, clen;
+	struct lz4_test_bufs b;
+
+	b.src = vmalloc(TEST_MAX_SIZE);
+	b.dst = vmalloc(TEST_MAX_SIZE);
+	b.cmp = vmalloc(lz4_compressbound(TEST_MAX_SIZE));
+	b.wrkmem = vmalloc(LZ4_MEM_COMPRESS);
+	if (!b.src || !b.dst || !b.cmp || !b.wrkmem)
+		goto out;
+
+	for (i = 0; i < ARRAY_SIZE(corpora); i++) {
+		for (j = 0; j < ARRAY_SIZE(test_sizes); j++) {
+			size = test_sizes[j];
+			test_seed = i * 7919 + size;
+			corpora[i].fill(b.src, size);
+
+			ret = lz4_compress(b.src, size, b.cmp, &clen, b.wrkmem);
+			if (ret) {
+				pr_err("lz4 test: %s %zu bytes: compress failed\n",
+					corpora[i].name, size);
+				ret = -EINVAL;
+				goto out;
+			}
+
+			ret = test_lz4_check(&b, corpora[i].name, size, clen);
+			if (ret)
+				goto out;
+
+			pr_info("lz4 test: %-8s %6zu -> %6zu bytes: "
+				"arch %llu MB/s, generic %llu MB/s\n",
+				corpora[i].name, size, clen,
+				test_lz4_bench(&decompressors[0], &b, size),
+				test_lz4_bench(&decompressors[1], &b, size));
+		}
+	}
+	ret = 0;
+
+out:
+	vfree(b.wrkmem);
+	vfree(b.cmp);
+	vfree(b.dst);
+	vfree(b.src);
+	return ret;
+}
+
+static void __exit test_lz4_exit(void)
+{
+}
+
+module_init(test_lz4_init);
+module_exit(test_lz4_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 decompressor test and benchmark");
@@ -1260,6 +1260,14 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 		}
   	}
 
+	/* A lazily freed page written to again is no longer free. */
+	if ((flags & TTU_LZFREE) && pte_dirty(*pte)) {
+		ClearPageLazyFree(page);
+		set_page_dirty(page);
+		ret = SWAP_FAIL;
+		goto out_unmap;
+	}
+
 	/* Nuke the page table entry. */
 	flush_cache_page(vma, address, page_to_pfn(page));
 	pteval = ptep_clear_flush_notify(vma, address, pte);
@@ -1281,6 +1289,21 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	} else if (PageAnon(page)) {
 		swp_entry_t entry = { .val = page_private(page) };
 
+		if ((flags & TTU_LZFREE) && !PageSwapCache(page)) {
+			/*
+			 * The pte was dirtied after the check above: put
+			 * it back and let reclaim swap the page out.
+			 */
+			if (PageDirty(page)) {
+				ClearPageLazyFree(page);
+				set_pte_at(mm, address, pte, pteval);
+				ret = SWAP_FAIL;
+				goto out_unmap;
+			}
+			dec_mm_counter(mm, MM_ANONPAGES);
+			goto discard;
+		}
+
 		if (PageSwapCache(page)) {
 			/*
 			 * Store the swap location in the pte.
@@ -1319,6 +1342,7 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	} else
 		dec_mm_counter(mm, MM_FILEPAGES);
 
+discard:
 	page_remove_rmap(page);
 	page_cache_release(page);
 